@@ -0,0 +1,96 @@
+/*
+ * Scaling benchmark for the row-band pool used by process_png_file().
+ *
+ * Usage: pool_scaling [max_threads] [width] [height] [repetitions]
+ *
+ * Thresholds a synthetic RGBA image with 1..max_threads threads, in bands
+ * of the same size as the harness, and reports the time and speedup.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kernel.h"
+#include "pool.h"
+
+#define BAND_BYTES (256 << 10)
+
+struct image
+{
+    uint8_t *pixels;
+    size_t width;
+};
+
+static void process_rows(void *arg, size_t begin, size_t end)
+{
+    struct image *image = arg;
+
+    for (size_t y = begin; y < end; y++)
+        threshold_kernel.fn(&image->pixels[y * image->width * 4], image->width);
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned max_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    size_t width = argc > 2 ? strtoul(argv[2], NULL, 0) : 4096;
+    size_t height = argc > 3 ? strtoul(argv[3], NULL, 0) : 4096;
+    int repetitions = argc > 4 ? atoi(argv[4]) : 20;
+
+    kernel_init();
+
+    struct image image = {malloc(width * height * 4), width};
+    if (!image.pixels)
+    {
+        printf("FAIL on %s: malloc()\n", __func__);
+        return 1;
+    }
+
+    for (size_t i = 0; i < width * height * 4; i++)
+        image.pixels[i] = rand();
+
+    size_t band = BAND_BYTES / (width * 4);
+    if (!band)
+        band = 1;
+
+    printf("%zux%zu RGBA, %zu rows per band, %s kernel\n", width, height, band, threshold_kernel.name);
+    printf("threads   ms/image   Mpixel/s   speedup\n");
+
+    double serial = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads++)
+    {
+        struct pool *pool = pool_create(threads);
+        if (!pool)
+        {
+            printf("FAIL on %s: pool_create()\n", __func__);
+            return 1;
+        }
+
+        // Warm up the workers and the caches
+        pool_run(pool, process_rows, &image, height, band);
+
+        double start = now();
+        for (int i = 0; i < repetitions; i++)
+            pool_run(pool, process_rows, &image, height, band);
+        double elapsed = (now() - start) / repetitions;
+
+        if (threads == 1)
+            serial = elapsed;
+
+        printf("%7u %10.3f %10.1f %9.2fx\n", threads, elapsed * 1e3,
+               width * height / elapsed / 1e6, serial / elapsed);
+
+        pool_destroy(pool);
+    }
+
+    free(image.pixels);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * The harness's progressive pipeline against its whole-image decode.
+ *
+ * Usage: progressive [repetitions] <png_file>...
+ *
+ * Every input is decoded to 8bit RGBA by read_png_file() (png_read_image()
+ * into a whole bitmap), and by progressive_main() under several feeding
+ * schedules: the fixed 4K pieces, and a few seeds of the random 1 byte to 8K
+ * pieces a selector can pick, as they would arrive from a network stream.
+ * Both run with the progressive pipeline's fixed transforms. Reports the time
+ * per image, the pixel throughput, and the peak memory over the inputs: the
+ * arena's high-water mark (libpng's own allocations and the rows), plus the
+ * slab holding read_png_file()'s bitmap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <png.h>
+
+#include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "input.h"
+#include "selector.h"
+
+struct image
+{
+    struct input input;
+    size_t pixels; // 0 when a mode does not decode it in full
+};
+
+struct mode
+{
+    const char *name;
+    int pull;          // read_png_file() rather than progressive_main()
+    unsigned schedule; // The selector's feeding schedule
+
+    double seconds;
+    size_t peak;
+    double peaks; // Sum over the inputs
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns non-zero if the input was not decoded in full
+static int run(struct decode_ctx *ctx, const struct mode *mode, const struct image *image)
+{
+    struct selector selector = selector_progressive;
+    selector.schedule = mode->schedule;
+
+    if (mode->pull)
+        return read_png_file(ctx, image->input.data, image->input.size, &selector);
+
+    return progressive_main(image->input.data, image->input.size, &ctx->arena, &selector);
+}
+
+// Arena bytes, and the bitmap when the whole image was kept
+static size_t peak(const struct decode_ctx *ctx, const struct mode *mode)
+{
+    return ctx->arena.peak + (mode->pull ? ctx->slab.size : 0);
+}
+
+// Only inputs the simplified API reads in full, within the governor's limits
+static int load(struct image *image, const char *file)
+{
+    if (input_map(file, &image->input))
+        return 1;
+
+    png_image info = {.version = PNG_IMAGE_VERSION};
+    if (!png_image_begin_read_from_memory(&info, image->input.data, image->input.size))
+        goto fail;
+
+    info.format = PNG_FORMAT_RGBA;
+    if (governor_check_pixels(info.width, info.height))
+    {
+        png_image_free(&info);
+        goto fail;
+    }
+
+    png_bytep pixels = malloc(PNG_IMAGE_SIZE(info));
+    int ok = pixels && png_image_finish_read(&info, NULL, pixels, 0, NULL);
+    free(pixels);
+    png_image_free(&info);
+
+    if (ok)
+    {
+        image->pixels = (size_t)info.width * info.height;
+        return 0;
+    }
+
+fail:
+    input_unmap(&image->input);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct mode modes[] = {
+        {.name = "read_png", .pull = 1},
+        {.name = "push 4K"},
+        {.name = "push seed 1", .schedule = 1},
+        {.name = "push seed 21", .schedule = 21},
+        {.name = "push seed 63", .schedule = 63},
+    };
+    int nmodes = sizeof(modes) / sizeof(modes[0]);
+    size_t pixels = 0;
+    int repetitions = 20, decoded = 0;
+    const char *name = argv[0];
+
+    char *end;
+    if (argc > 1 && strtol(argv[1], &end, 10) > 0 && !*end)
+    {
+        repetitions = atoi(argv[1]);
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2)
+    {
+        printf("Usage: %s [repetitions] <png_file>...\n", name);
+        return 1;
+    }
+
+    harness_init();
+
+    struct image *images = calloc(argc - 1, sizeof(struct image));
+    if (!images)
+    {
+        printf("FAIL on %s: calloc()\n", __func__);
+        return 1;
+    }
+
+    struct decode_ctx ctx;
+    decode_ctx_init(&ctx, SINK_DISCARD, NULL);
+
+    int count = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        struct image *image = &images[count];
+        if (load(image, argv[i]))
+            continue;
+        count++;
+
+        // Only inputs that every mode decodes in full are compared
+        for (int m = 0; m < nmodes && image->pixels; m++)
+        {
+            if (run(&ctx, &modes[m], image))
+                image->pixels = 0;
+            decode_ctx_reset(&ctx);
+        }
+
+        pixels += image->pixels;
+        decoded += image->pixels != 0;
+    }
+
+    for (int m = 0; m < nmodes; m++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            size_t image_peak = 0;
+            if (!images[i].pixels)
+                continue;
+
+            double start = now();
+            for (int r = 0; r < repetitions; r++)
+            {
+                run(&ctx, &modes[m], &images[i]);
+                if (peak(&ctx, &modes[m]) > image_peak)
+                    image_peak = peak(&ctx, &modes[m]);
+                decode_ctx_reset(&ctx);
+            }
+            modes[m].seconds += now() - start;
+
+            if (image_peak > modes[m].peak)
+                modes[m].peak = image_peak;
+            modes[m].peaks += image_peak;
+        }
+    }
+
+    printf("%d of %d inputs decoded, %zu pixels, %d repetitions\n", decoded, argc - 1, pixels, repetitions);
+    printf("mode           ms/image   Mpixel/s   peak KiB   mean peak KiB\n");
+
+    for (int m = 0; m < nmodes && decoded; m++)
+    {
+        double per_image = modes[m].seconds / repetitions / decoded;
+        printf("%-12s %10.3f %10.1f %10.1f %15.1f\n", modes[m].name, per_image * 1e3,
+               pixels * (double)repetitions / modes[m].seconds / 1e6, modes[m].peak / 1024.0,
+               modes[m].peaks / decoded / 1024.0);
+    }
+
+    decode_ctx_free(&ctx);
+    band_free();
+    for (int i = 0; i < count; i++)
+        input_unmap(&images[i].input);
+    free(images);
+    return 0;
+}
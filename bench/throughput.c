@@ -0,0 +1,380 @@
+/*
+ * Decode throughput of each of the harness's pipelines.
+ *
+ * Usage: throughput [-w warmup] [-r repetitions] [-o results.json] <png_file>...
+ *        throughput --compare <baseline.json> <results.json> [threshold_percent]
+ *
+ * Inputs that the simplified API reads in full are run through the
+ * harness's own pipeline code: pngtopng_main() (simplified API),
+ * example1_main() (row by row), read_png_file() + process_png_file() +
+ * write_png_file() (whole image) and stream_png_file() (the decoder's row
+ * streaming). Every pipeline gets [warmup] untimed passes over all inputs,
+ * then [repetitions] timed ones, each a sample of images/s, decoded MB/s
+ * (the 8bit RGBA size of the images) and encoded MB/s. Only the inputs a
+ * pipeline decodes count towards its images and decoded bytes. Means are reported
+ * with their 95% confidence interval, and written as JSON with -o.
+ *
+ * --compare reads two such files and flags every metric that got slower by
+ * more than [threshold_percent] (2 by default) with confidence intervals
+ * that do not overlap. It exits with 1 if anything regressed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <png.h>
+
+#include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "input.h"
+#include "selector.h"
+
+#define RESULTS_VERSION 1
+#define MAX_RESULTS 64
+
+struct image
+{
+    struct input input;
+    size_t decoded; // 8bit RGBA bytes
+};
+
+struct pipeline
+{
+    const char *name;
+    // Non-zero if the input did not decode, *encoded is the output's bytes
+    int (*run)(struct decode_ctx *ctx, const struct image *image, size_t *encoded);
+};
+
+enum metric
+{
+    IMAGES_PER_S,
+    DECODED_MB_PER_S,
+    ENCODED_MB_PER_S,
+    METRICS,
+};
+
+static const char *metric_names[METRICS] = {
+    [IMAGES_PER_S] = "images_per_s",
+    [DECODED_MB_PER_S] = "decoded_mb_per_s",
+    [ENCODED_MB_PER_S] = "encoded_mb_per_s",
+};
+
+// One line of the JSON results
+struct result
+{
+    char pipeline[32];
+    char metric[32];
+    double mean;
+    double ci95;
+};
+
+static int run_pngtopng(struct decode_ctx *ctx, const struct image *image, size_t *encoded)
+{
+    int result = pngtopng_main(image->input.data, image->input.size, &ctx->arena, &ctx->sink, &selector_pngtopng);
+    *encoded = ctx->sink.length;
+    return result;
+}
+
+static int run_example1(struct decode_ctx *ctx, const struct image *image, size_t *encoded)
+{
+    *encoded = 0;
+    return example1_main(image->input.data, image->input.size, &ctx->arena, &selector_example1);
+}
+
+// Encodes what was decoded even when the read failed, as the harness does
+static int run_read_write(struct decode_ctx *ctx, const struct image *image, size_t *encoded)
+{
+    int result = read_png_file(ctx, image->input.data, image->input.size, &selector_decode);
+    process_png_file(ctx);
+    write_png_file(ctx);
+    *encoded = ctx->sink.length;
+    return result;
+}
+
+static int run_stream(struct decode_ctx *ctx, const struct image *image, size_t *encoded)
+{
+    int result = stream_png_file(ctx, image->input.data, image->input.size, &selector_decode);
+    *encoded = ctx->sink.length;
+    return result;
+}
+
+static const struct pipeline pipelines[] = {
+    {"pngtopng", run_pngtopng},
+    {"example1", run_example1},
+    {"read_write", run_read_write},
+    {"stream", run_stream},
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Two-sided 95% quantiles of Student's t, by degrees of freedom
+static double student_t95(int df)
+{
+    static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                               2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                               2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+    if (df < 1)
+        return 0;
+    return df <= 30 ? t[df - 1] : 1.960;
+}
+
+static void summarize(const double *samples, int count, double *mean, double *ci95)
+{
+    double sum = 0, squares = 0;
+
+    for (int i = 0; i < count; i++)
+        sum += samples[i];
+    *mean = sum / count;
+
+    for (int i = 0; i < count; i++)
+        squares += (samples[i] - *mean) * (samples[i] - *mean);
+
+    *ci95 = count > 1 ? student_t95(count - 1) * sqrt(squares / (count - 1) / count) : 0;
+}
+
+// Only inputs the simplified API reads in full, within the governor's limits
+static int load(struct image *image, const char *file)
+{
+    if (input_map(file, &image->input))
+        return 1;
+
+    png_image info = {.version = PNG_IMAGE_VERSION};
+    if (!png_image_begin_read_from_memory(&info, image->input.data, image->input.size))
+        goto fail;
+
+    info.format = PNG_FORMAT_RGBA;
+    if (governor_check_pixels(info.width, info.height))
+    {
+        png_image_free(&info);
+        goto fail;
+    }
+
+    image->decoded = PNG_IMAGE_SIZE(info);
+    png_bytep pixels = malloc(image->decoded);
+    int ok = pixels && png_image_finish_read(&info, NULL, pixels, 0, NULL);
+    free(pixels);
+    png_image_free(&info);
+
+    if (ok)
+        return 0;
+
+fail:
+    input_unmap(&image->input);
+    return 1;
+}
+
+static void write_results(FILE *fp, const struct result *results, int count, int warmup, int repetitions,
+                          int images, size_t decoded)
+{
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"version\": %d,\n", RESULTS_VERSION);
+    fprintf(fp, "  \"warmup\": %d,\n", warmup);
+    fprintf(fp, "  \"repetitions\": %d,\n", repetitions);
+    fprintf(fp, "  \"images\": %d,\n", images);
+    fprintf(fp, "  \"decoded_bytes\": %zu,\n", decoded);
+    fprintf(fp, "  \"results\": [\n");
+
+    // One result per line, --compare relies on it
+    for (int i = 0; i < count; i++)
+        fprintf(fp, "    {\"pipeline\": \"%s\", \"metric\": \"%s\", \"mean\": %.6g, \"ci95\": %.6g}%s\n",
+                results[i].pipeline, results[i].metric, results[i].mean, results[i].ci95, i + 1 < count ? "," : "");
+
+    fprintf(fp, "  ]\n}\n");
+}
+
+static int read_results(const char *file, struct result *results)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+    {
+        printf("FAIL on %s: cannot read %s\n", __func__, file);
+        return -1;
+    }
+
+    char line[512];
+    int count = 0;
+    while (count < MAX_RESULTS && fgets(line, sizeof(line), fp))
+    {
+        struct result *result = &results[count];
+        if (sscanf(line, " {\"pipeline\": \"%31[^\"]\", \"metric\": \"%31[^\"]\", \"mean\": %lf, \"ci95\": %lf",
+                   result->pipeline, result->metric, &result->mean, &result->ci95) == 4)
+            count++;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+static int compare(const char *baseline_file, const char *results_file, double threshold)
+{
+    static struct result baseline[MAX_RESULTS], results[MAX_RESULTS];
+    int regressions = 0;
+
+    int baseline_count = read_results(baseline_file, baseline);
+    int results_count = read_results(results_file, results);
+    if (baseline_count < 0 || results_count < 0)
+        return 1;
+
+    printf("%-12s %-18s %19s %19s %10s\n", "pipeline", "metric", "baseline", "results", "change");
+
+    for (int i = 0; i < results_count; i++)
+    {
+        const struct result *now = &results[i];
+        const struct result *before = NULL;
+
+        for (int j = 0; j < baseline_count && !before; j++)
+            if (!strcmp(baseline[j].pipeline, now->pipeline) && !strcmp(baseline[j].metric, now->metric))
+                before = &baseline[j];
+
+        // Nothing to compare against, or nothing measured (example1 does not encode)
+        if (!before || before->mean <= 0)
+            continue;
+
+        double change = (now->mean - before->mean) / before->mean * 100;
+        int slower = change < -threshold && now->mean + now->ci95 < before->mean - before->ci95;
+        int faster = change > threshold && now->mean - now->ci95 > before->mean + before->ci95;
+
+        printf("%-12s %-18s %10.2f +-%6.2f %10.2f +-%6.2f %+9.1f%% %s\n", now->pipeline, now->metric, before->mean,
+               before->ci95, now->mean, now->ci95, change, slower ? "REGRESSION" : faster ? "improved" : "");
+        regressions += slower;
+    }
+
+    printf("%d regressions over %.1f%%\n", regressions, threshold);
+    return regressions != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int warmup = 2, repetitions = 10;
+    const char *output = NULL;
+
+    if (argc >= 4 && !strcmp(argv[1], "--compare"))
+        return compare(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 2.0);
+
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp(argv[arg], "-w"))
+            warmup = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-r"))
+            repetitions = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-o"))
+            output = argv[arg + 1];
+        else
+            break;
+    }
+
+    if (arg >= argc || repetitions < 1 || warmup < 0)
+    {
+        printf("Usage: %s [-w warmup] [-r repetitions] [-o results.json] <png_file>...\n", argv[0]);
+        printf("       %s --compare <baseline.json> <results.json> [threshold_percent]\n", argv[0]);
+        return 1;
+    }
+
+    harness_init();
+
+    struct image *images = calloc(argc - arg, sizeof(struct image));
+    double *samples = calloc(repetitions * METRICS, sizeof(double));
+    if (!images || !samples)
+    {
+        printf("FAIL on %s: calloc()\n", __func__);
+        return 1;
+    }
+
+    int count = 0;
+    size_t decoded = 0;
+    for (int i = arg; i < argc; i++)
+        if (!load(&images[count], argv[i]))
+            decoded += images[count++].decoded;
+
+    printf("%d of %d inputs decoded, %.1f MB of RGBA, %d warmup passes, %d repetitions\n", count, argc - arg,
+           decoded / 1e6, warmup, repetitions);
+    if (!count)
+        return 1;
+
+    struct decode_ctx ctx;
+    decode_ctx_init(&ctx, SINK_DISCARD, NULL);
+
+    struct result results[MAX_RESULTS];
+    int nresults = 0;
+    int npipelines = sizeof(pipelines) / sizeof(pipelines[0]);
+
+    printf("%-12s %19s %19s %19s\n", "pipeline", "images/s", "decoded MB/s", "encoded MB/s");
+
+    for (int p = 0; p < npipelines; p++)
+    {
+        for (int r = -warmup; r < repetitions; r++)
+        {
+            size_t encoded = 0, pass_decoded = 0;
+            int pass_images = 0;
+            double start = now();
+
+            // Inputs a pipeline rejects still take time, but are not credited
+            for (int i = 0; i < count; i++)
+            {
+                size_t bytes;
+                if (!pipelines[p].run(&ctx, &images[i], &bytes))
+                {
+                    pass_images++;
+                    pass_decoded += images[i].decoded;
+                }
+                encoded += bytes;
+                decode_ctx_reset(&ctx);
+            }
+
+            double seconds = now() - start;
+            if (r < 0)
+                continue;
+
+            samples[r * METRICS + IMAGES_PER_S] = pass_images / seconds;
+            samples[r * METRICS + DECODED_MB_PER_S] = pass_decoded / seconds / 1e6;
+            samples[r * METRICS + ENCODED_MB_PER_S] = encoded / seconds / 1e6;
+        }
+
+        printf("%-12s", pipelines[p].name);
+        for (int m = 0; m < METRICS; m++)
+        {
+            double metric[repetitions];
+            for (int r = 0; r < repetitions; r++)
+                metric[r] = samples[r * METRICS + m];
+
+            struct result *result = &results[nresults++];
+            snprintf(result->pipeline, sizeof(result->pipeline), "%s", pipelines[p].name);
+            snprintf(result->metric, sizeof(result->metric), "%s", metric_names[m]);
+            summarize(metric, repetitions, &result->mean, &result->ci95);
+
+            printf(" %10.2f +-%6.2f", result->mean, result->ci95);
+        }
+        printf("\n");
+    }
+
+    if (output)
+    {
+        FILE *fp = fopen(output, "w");
+        if (!fp)
+        {
+            printf("FAIL on %s: cannot write %s\n", __func__, output);
+            return 1;
+        }
+
+        write_results(fp, results, nresults, warmup, repetitions, count, decoded);
+        fclose(fp);
+        printf("Results written to %s\n", output);
+    }
+
+    decode_ctx_free(&ctx);
+    band_free();
+    for (int i = 0; i < count; i++)
+        input_unmap(&images[i].input);
+    free(images);
+    free(samples);
+    return 0;
+}
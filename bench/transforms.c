@@ -0,0 +1,585 @@
+/*
+ * Cost of each png_set_* transform, in isolation.
+ *
+ * Usage: transforms [repetitions] [size]...
+ *
+ * Synthetic images are encoded for every valid (color_type, bit_depth,
+ * interlace) combination, square, at each size (64, 256 and 1024 pixels
+ * wide by default). They carry PLTE and tRNS (palette), sBIT and gAMA, and
+ * RGB ones a suggested 256 color PLTE, so that every transform has something
+ * to do. Each image is decoded with
+ * png_read_image() without any transform, then with each transform that
+ * applies to it on its own. A measurement decodes the image over and over
+ * for at least 10ms; the best of [repetitions] (3 by default) is kept.
+ *
+ * Prints ns/pixel of the plain decode and, for each transform, its ns/pixel
+ * and what it adds to the plain decode, then a summary of the added cost of
+ * each transform over every combination. "rgba" is decode_set_rgba() with
+ * read_png_file()'s fixed selector, the normalisation to 8bit RGBA the
+ * harness's decoder always sets.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <png.h>
+
+#include "decode.h"
+#include "selector.h"
+
+#define MIN_SECONDS 0.01
+#define MAX_SCREEN_COLORS 55 // As in example1.c
+
+struct buffer
+{
+    png_bytep data;
+    size_t size;
+    size_t capacity;
+};
+
+struct reader
+{
+    const struct buffer *buffer;
+    size_t offset;
+};
+
+struct format
+{
+    const char *name;
+    int color_type;
+    int bit_depth;
+};
+
+struct transform
+{
+    const char *name;
+    int (*applies)(int color_type, int bit_depth);
+    void (*set)(png_structp png, png_infop info);
+
+    // Summary over every combination it applies to
+    int count;
+    double added;
+    double worst;
+    char worst_on[64];
+};
+
+static const struct format formats[] = {
+    {"gray", PNG_COLOR_TYPE_GRAY, 1},
+    {"gray", PNG_COLOR_TYPE_GRAY, 2},
+    {"gray", PNG_COLOR_TYPE_GRAY, 4},
+    {"gray", PNG_COLOR_TYPE_GRAY, 8},
+    {"gray", PNG_COLOR_TYPE_GRAY, 16},
+    {"gray_alpha", PNG_COLOR_TYPE_GRAY_ALPHA, 8},
+    {"gray_alpha", PNG_COLOR_TYPE_GRAY_ALPHA, 16},
+    {"rgb", PNG_COLOR_TYPE_RGB, 8},
+    {"rgb", PNG_COLOR_TYPE_RGB, 16},
+    {"palette", PNG_COLOR_TYPE_PALETTE, 1},
+    {"palette", PNG_COLOR_TYPE_PALETTE, 2},
+    {"palette", PNG_COLOR_TYPE_PALETTE, 4},
+    {"palette", PNG_COLOR_TYPE_PALETTE, 8},
+    {"rgb_alpha", PNG_COLOR_TYPE_RGB_ALPHA, 8},
+    {"rgb_alpha", PNG_COLOR_TYPE_RGB_ALPHA, 16},
+};
+
+static int is_16(int color_type, int bit_depth) { return bit_depth == 16; }
+static int is_low(int color_type, int bit_depth) { return bit_depth < 8; }
+static int is_palette(int color_type, int bit_depth) { return color_type == PNG_COLOR_TYPE_PALETTE; }
+static int is_gray(int color_type, int bit_depth) { return (color_type & PNG_COLOR_MASK_COLOR) == 0; }
+static int is_alpha(int color_type, int bit_depth) { return (color_type & PNG_COLOR_MASK_ALPHA) != 0; }
+static int is_any(int color_type, int bit_depth) { return 1; }
+
+// Palette images are expanded to RGB before any color transform sees them
+static int is_color(int color_type, int bit_depth)
+{
+    return color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_RGB_ALPHA;
+}
+
+static int is_low_gray(int color_type, int bit_depth)
+{
+    return color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8;
+}
+
+static int is_expandable(int color_type, int bit_depth)
+{
+    return color_type == PNG_COLOR_TYPE_PALETTE || bit_depth < 8;
+}
+
+// Only palette images carry tRNS
+static int is_transparent(int color_type, int bit_depth)
+{
+    return is_alpha(color_type, bit_depth) || color_type == PNG_COLOR_TYPE_PALETTE;
+}
+
+static int is_opaque_8_16(int color_type, int bit_depth)
+{
+    return (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_RGB) && bit_depth >= 8;
+}
+
+static int is_color_8(int color_type, int bit_depth)
+{
+    return (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_RGB_ALPHA) && bit_depth == 8;
+}
+
+// example1.c only quantizes to a PLTE with more than MAX_SCREEN_COLORS entries
+static int is_plte_256(int color_type, int bit_depth)
+{
+    return color_type == PNG_COLOR_TYPE_PALETTE ? bit_depth == 8 : is_color(color_type, bit_depth);
+}
+
+// sBIT is written for everything but palette images
+static int is_shiftable(int color_type, int bit_depth)
+{
+    return color_type != PNG_COLOR_TYPE_PALETTE;
+}
+
+static void set_scale_16(png_structp png, png_infop info) { png_set_scale_16(png); }
+static void set_strip_16(png_structp png, png_infop info) { png_set_strip_16(png); }
+static void set_strip_alpha(png_structp png, png_infop info) { png_set_strip_alpha(png); }
+static void set_packing(png_structp png, png_infop info) { png_set_packing(png); }
+static void set_packswap(png_structp png, png_infop info) { png_set_packswap(png); }
+static void set_palette_to_rgb(png_structp png, png_infop info) { png_set_palette_to_rgb(png); }
+static void set_expand_gray(png_structp png, png_infop info) { png_set_expand_gray_1_2_4_to_8(png); }
+static void set_trns_to_alpha(png_structp png, png_infop info) { png_set_tRNS_to_alpha(png); }
+static void set_expand(png_structp png, png_infop info) { png_set_expand(png); }
+static void set_expand_16(png_structp png, png_infop info) { png_set_expand_16(png); }
+static void set_gray_to_rgb(png_structp png, png_infop info) { png_set_gray_to_rgb(png); }
+static void set_invert_mono(png_structp png, png_infop info) { png_set_invert_mono(png); }
+static void set_invert_alpha(png_structp png, png_infop info) { png_set_invert_alpha(png); }
+static void set_bgr(png_structp png, png_infop info) { png_set_bgr(png); }
+static void set_swap_alpha(png_structp png, png_infop info) { png_set_swap_alpha(png); }
+static void set_swap(png_structp png, png_infop info) { png_set_swap(png); }
+
+static void set_rgb_to_gray(png_structp png, png_infop info)
+{
+    png_set_rgb_to_gray(png, PNG_ERROR_ACTION_NONE, -1, -1);
+}
+
+static void set_filler(png_structp png, png_infop info)
+{
+    png_set_filler(png, 0xffff, PNG_FILLER_AFTER);
+}
+
+static void set_background(png_structp png, png_infop info)
+{
+    png_color_16 background = {.red = 0x80, .green = 0x80, .blue = 0x80, .gray = 0x80};
+    png_set_background(png, &background, PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
+}
+
+// Images are encoded for an sRGB screen, which libpng would not correct
+static void set_gamma(png_structp png, png_infop info)
+{
+    png_set_gamma(png, PNG_GAMMA_LINEAR, 0.45455);
+}
+
+static void set_alpha_mode(png_structp png, png_infop info)
+{
+    png_set_alpha_mode(png, PNG_ALPHA_PREMULTIPLIED, PNG_DEFAULT_sRGB);
+}
+
+// To a 6x6x6 color cube. Without full_quantize libpng only remaps palette
+// indices, and leaves RGB untouched
+static void set_quantize(png_structp png, png_infop info)
+{
+    static png_color cube[216];
+    for (int i = 0; i < 216; i++)
+    {
+        cube[i].red = i / 36 * 51;
+        cube[i].green = i / 6 % 6 * 51;
+        cube[i].blue = i % 6 * 51;
+    }
+    png_set_quantize(png, cube, 216, 256, NULL, 1);
+}
+
+// What example1.c does: down to MAX_SCREEN_COLORS of the file's own PLTE
+static void set_quantize_plte(png_structp png, png_infop info)
+{
+    png_colorp palette;
+    int num_palette;
+    png_uint_16p histogram = NULL;
+
+    if (!png_get_PLTE(png, info, &palette, &num_palette))
+        return;
+
+    png_get_hIST(png, info, &histogram);
+    png_set_quantize(png, palette, num_palette, MAX_SCREEN_COLORS, histogram, 0);
+}
+
+static void set_shift(png_structp png, png_infop info)
+{
+    png_color_8p sig_bit;
+    if (png_get_sBIT(png, info, &sig_bit))
+        png_set_shift(png, sig_bit);
+}
+
+// The harness's own normalisation, with read_png_file()'s fixed selector
+static void set_rgba(png_structp png, png_infop info)
+{
+    decode_set_rgba(png, info, &selector_decode);
+}
+
+static struct transform transforms[] = {
+    {.name = "scale_16", .applies = is_16, .set = set_scale_16},
+    {.name = "strip_16", .applies = is_16, .set = set_strip_16},
+    {.name = "strip_alpha", .applies = is_alpha, .set = set_strip_alpha},
+    {.name = "packing", .applies = is_low, .set = set_packing},
+    {.name = "packswap", .applies = is_low, .set = set_packswap},
+    {.name = "palette_to_rgb", .applies = is_palette, .set = set_palette_to_rgb},
+    {.name = "expand_gray", .applies = is_low_gray, .set = set_expand_gray},
+    {.name = "tRNS_to_alpha", .applies = is_palette, .set = set_trns_to_alpha},
+    {.name = "expand", .applies = is_expandable, .set = set_expand},
+    {.name = "expand_16", .applies = is_any, .set = set_expand_16},
+    {.name = "gray_to_rgb", .applies = is_gray, .set = set_gray_to_rgb},
+    {.name = "rgb_to_gray", .applies = is_color, .set = set_rgb_to_gray},
+    {.name = "background", .applies = is_transparent, .set = set_background},
+    {.name = "gamma", .applies = is_any, .set = set_gamma},
+    {.name = "alpha_mode", .applies = is_alpha, .set = set_alpha_mode},
+    {.name = "quantize", .applies = is_color_8, .set = set_quantize},
+    {.name = "quantize_plte", .applies = is_plte_256, .set = set_quantize_plte},
+    {.name = "invert_mono", .applies = is_gray, .set = set_invert_mono},
+    {.name = "invert_alpha", .applies = is_alpha, .set = set_invert_alpha},
+    {.name = "shift", .applies = is_shiftable, .set = set_shift},
+    {.name = "bgr", .applies = is_color, .set = set_bgr},
+    {.name = "swap_alpha", .applies = is_alpha, .set = set_swap_alpha},
+    {.name = "swap", .applies = is_16, .set = set_swap},
+    {.name = "filler", .applies = is_opaque_8_16, .set = set_filler},
+    {.name = "rgba", .applies = is_any, .set = set_rgba},
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_fn(png_structp png_ptr, png_bytep data, size_t length)
+{
+    struct buffer *buffer = png_get_io_ptr(png_ptr);
+
+    if (length > buffer->capacity - buffer->size)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (capacity - buffer->size < length)
+            capacity *= 2;
+
+        png_bytep data = realloc(buffer->data, capacity);
+        if (!data)
+            png_error(png_ptr, "out of memory");
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+}
+
+static void read_fn(png_structp png_ptr, png_bytep out, size_t length)
+{
+    struct reader *reader = png_get_io_ptr(png_ptr);
+
+    if (length > reader->buffer->size - reader->offset)
+        png_error(png_ptr, "read past the end of the input");
+
+    memcpy(out, reader->buffer->data + reader->offset, length);
+    reader->offset += length;
+}
+
+// Gradients with some noise, compressible but not trivially
+static int encode(struct buffer *buffer, const struct format *format, int interlace, png_uint_32 size)
+{
+    png_bytep volatile row = NULL;
+    png_uint_32 rng = 0x2545f491;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+        return 1;
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+    {
+        png_destroy_write_struct(&png, NULL);
+        return 1;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        free(row);
+        png_destroy_write_struct(&png, &info);
+        return 1;
+    }
+
+    png_set_write_fn(png, buffer, write_fn, NULL);
+    png_set_IHDR(png, info, size, size, format->bit_depth, format->color_type,
+                 interlace ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_set_gAMA(png, info, 0.45455);
+
+    if (format->color_type == PNG_COLOR_TYPE_PALETTE)
+    {
+        png_color palette[256];
+        png_byte alpha[256];
+        int entries = 1 << format->bit_depth;
+
+        for (int i = 0; i < entries; i++)
+        {
+            palette[i].red = i * 255 / (entries - 1);
+            palette[i].green = 255 - palette[i].red;
+            palette[i].blue = i * 37;
+            alpha[i] = i * 255 / (entries - 1);
+        }
+
+        png_set_PLTE(png, info, palette, entries);
+        png_set_tRNS(png, info, alpha, entries, NULL);
+    }
+    else
+    {
+        png_byte bits = format->bit_depth > 1 ? format->bit_depth - 1 : 1;
+        png_color_8 sig_bit = {.red = bits, .green = bits, .blue = bits, .gray = bits, .alpha = bits};
+        png_set_sBIT(png, info, &sig_bit);
+    }
+
+    // A suggested palette, for viewers that cannot show true color
+    if (format->color_type & PNG_COLOR_MASK_COLOR && format->color_type != PNG_COLOR_TYPE_PALETTE)
+    {
+        png_color palette[256];
+        for (int i = 0; i < 256; i++)
+        {
+            palette[i].red = i;
+            palette[i].green = 255 - i;
+            palette[i].blue = i * 37;
+        }
+        png_set_PLTE(png, info, palette, 256);
+    }
+
+    png_write_info(png, info);
+
+    size_t rowbytes = png_get_rowbytes(png, info);
+    row = malloc(rowbytes);
+    if (!row)
+        png_error(png, "out of memory");
+
+    int passes = png_set_interlace_handling(png);
+    for (int pass = 0; pass < passes; pass++)
+        for (png_uint_32 y = 0; y < size; y++)
+        {
+            for (size_t i = 0; i < rowbytes; i++)
+            {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+                row[i] = (png_byte)(i * 3 + y + (rng & 7));
+            }
+            png_write_row(png, row);
+        }
+
+    png_write_end(png, info);
+
+    free(row);
+    png_destroy_write_struct(&png, &info);
+    return 0;
+}
+
+// Seconds for one png_read_image() with the transform, negative if libpng refuses it
+static double decode(const struct buffer *buffer, const struct transform *transform, png_bytep *pixels,
+                     size_t *capacity)
+{
+    struct reader reader = {buffer, 0};
+    png_bytep *volatile rows = NULL;
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+        return -1;
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+    {
+        png_destroy_read_struct(&png, NULL, NULL);
+        return -1;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        free(rows);
+        png_destroy_read_struct(&png, &info, NULL);
+        return -1;
+    }
+
+    double start = now();
+
+    png_set_read_fn(png, &reader, read_fn);
+    png_read_info(png, info);
+
+    if (transform)
+        transform->set(png, info);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    png_uint_32 height = png_get_image_height(png, info);
+    size_t rowbytes = png_get_rowbytes(png, info);
+
+    // The pixels are kept across decodes, so that only libpng is measured
+    if (rowbytes * height > *capacity)
+    {
+        png_bytep grown = realloc(*pixels, rowbytes * height);
+        if (!grown)
+            png_error(png, "out of memory");
+        *pixels = grown;
+        *capacity = rowbytes * height;
+    }
+
+    rows = malloc(height * sizeof(png_bytep));
+    if (!rows)
+        png_error(png, "out of memory");
+    for (png_uint_32 y = 0; y < height; y++)
+        rows[y] = *pixels + y * rowbytes;
+
+    png_read_image(png, rows);
+    png_read_end(png, NULL);
+
+    double seconds = now() - start;
+
+    free(rows);
+    png_destroy_read_struct(&png, &info, NULL);
+    return seconds;
+}
+
+// Best time per decode over the repetitions, each lasting at least MIN_SECONDS
+static double measure(const struct buffer *buffer, const struct transform *transform, int repetitions,
+                      png_bytep *pixels, size_t *capacity)
+{
+    double best = -1;
+
+    for (int r = 0; r < repetitions; r++)
+    {
+        double total = 0;
+        int decodes = 0;
+
+        while (total < MIN_SECONDS)
+        {
+            double seconds = decode(buffer, transform, pixels, capacity);
+            if (seconds < 0)
+                return -1;
+
+            total += seconds;
+            decodes++;
+        }
+
+        if (best < 0 || total / decodes < best)
+            best = total / decodes;
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    png_uint_32 default_sizes[] = {64, 256, 1024};
+    png_uint_32 *sizes = default_sizes;
+    int nsizes = 3, repetitions = 3;
+    int nformats = sizeof(formats) / sizeof(formats[0]);
+    int ntransforms = sizeof(transforms) / sizeof(transforms[0]);
+
+    char *end;
+    if (argc > 1 && strtol(argv[1], &end, 10) > 0 && !*end)
+    {
+        repetitions = atoi(argv[1]);
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1)
+    {
+        nsizes = argc - 1;
+        sizes = calloc(nsizes, sizeof(png_uint_32));
+        if (!sizes)
+        {
+            printf("FAIL on %s: calloc()\n", __func__);
+            return 1;
+        }
+
+        for (int i = 0; i < nsizes; i++)
+            if ((sizes[i] = strtoul(argv[i + 1], NULL, 10)) == 0)
+            {
+                printf("Usage: transforms [repetitions] [size]...\n");
+                return 1;
+            }
+    }
+
+    struct buffer buffer = {0};
+    png_bytep pixels = NULL;
+    size_t capacity = 0;
+
+    printf("%-11s %5s %9s %5s  %-15s %9s %9s\n", "color_type", "depth", "interlace", "size", "transform", "ns/pixel",
+           "added");
+
+    for (int f = 0; f < nformats; f++)
+        for (int interlace = 0; interlace <= 1; interlace++)
+            for (int s = 0; s < nsizes; s++)
+            {
+                const struct format *format = &formats[f];
+                double pixel_count = (double)sizes[s] * sizes[s];
+                char combination[64];
+
+                snprintf(combination, sizeof(combination), "%s %d %s %u", format->name, format->bit_depth,
+                         interlace ? "adam7" : "none", sizes[s]);
+
+                buffer.size = 0;
+                if (encode(&buffer, format, interlace, sizes[s]))
+                {
+                    printf("FAIL on %s: cannot encode %s\n", __func__, combination);
+                    continue;
+                }
+
+                double plain = measure(&buffer, NULL, repetitions, &pixels, &capacity);
+                if (plain < 0)
+                {
+                    printf("FAIL on %s: cannot decode %s\n", __func__, combination);
+                    continue;
+                }
+
+                printf("%-11s %5d %9s %5u  %-15s %9.2f\n", format->name, format->bit_depth,
+                       interlace ? "adam7" : "none", sizes[s], "none", plain * 1e9 / pixel_count);
+
+                for (int t = 0; t < ntransforms; t++)
+                {
+                    struct transform *transform = &transforms[t];
+                    if (!transform->applies(format->color_type, format->bit_depth))
+                        continue;
+
+                    double seconds = measure(&buffer, transform, repetitions, &pixels, &capacity);
+                    if (seconds < 0)
+                    {
+                        printf("%-11s %5d %9s %5u  %-15s %9s\n", format->name, format->bit_depth,
+                               interlace ? "adam7" : "none", sizes[s], transform->name, "error");
+                        continue;
+                    }
+
+                    double added = (seconds - plain) * 1e9 / pixel_count;
+                    printf("%-11s %5d %9s %5u  %-15s %9.2f %+9.2f\n", format->name, format->bit_depth,
+                           interlace ? "adam7" : "none", sizes[s], transform->name, seconds * 1e9 / pixel_count,
+                           added);
+
+                    transform->count++;
+                    transform->added += added;
+                    if (transform->count == 1 || added > transform->worst)
+                    {
+                        transform->worst = added;
+                        snprintf(transform->worst_on, sizeof(transform->worst_on), "%s", combination);
+                    }
+                }
+                fflush(stdout);
+            }
+
+    printf("\n%-15s %12s %15s %15s  %s\n", "transform", "combinations", "mean added", "worst added", "worst on");
+    for (int t = 0; t < ntransforms; t++)
+        if (transforms[t].count)
+            printf("%-15s %12d %15.2f %15.2f  %s\n", transforms[t].name, transforms[t].count,
+                   transforms[t].added / transforms[t].count, transforms[t].worst, transforms[t].worst_on);
+
+    free(buffer.data);
+    free(pixels);
+    if (sizes != default_sizes)
+        free(sizes);
+    return 0;
+}
@@ -1,7 +1,6 @@
 #!/bin/bash
-# This is a small script that renames all the files in the corpus directory to have sequential names
+# This is a small script that renames all the files in the corpus directory to their content hash
 # This is to avoid issues like spaces in names and name conflicts etc...
+# The corpus store does the hashing (in parallel), dedupes and keeps corpus.index up to date
 
-cd ./corpus
-ls -v | cat -n | while read n f; do mv -n "$f" `sha256sum "$f" | head -c 40`_$n.png; done 
-#ls -v | cat -n | while read n f; do mv -n '$f' "$n.png"; done 
+cd "$(dirname "$0")" && make corpus-ingest
@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "asan.h"
+
+#ifdef HARNESS_ASAN
+// Keep ASan's eyes on libpng: everything outside live allocations is poisoned
+// and each allocation is followed by a redzone, growing with its size as
+// ASan's own do. Freed memory stays poisoned until the next reset.
+#define ARENA_REDZONE_MIN 32
+#define ARENA_REDZONE_MAX 2048
+#endif
+
+#define ARENA_ALIGN 16
+#define ARENA_HEADER 16                  // Holds the allocation size, keeps ARENA_ALIGN
+#define ARENA_BLOCK_MIN (1 << 20)        // First block size
+#define ARENA_RETAIN_MAX (64 << 20)      // Largest block kept across inputs
+#define ARENA_BLOCK_HEADER ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_BLOCK_DATA(block) ((unsigned char *)(block) + ARENA_BLOCK_HEADER)
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static size_t arena_redzone(size_t size)
+{
+#ifdef HARNESS_ASAN
+    size_t redzone = size / 4;
+    if (redzone < ARENA_REDZONE_MIN)
+        return ARENA_REDZONE_MIN;
+    return redzone < ARENA_REDZONE_MAX ? redzone : ARENA_REDZONE_MAX;
+#else
+    return 0;
+#endif
+}
+
+static struct arena_block *arena_block_new(size_t size)
+{
+    struct arena_block *block = malloc(ARENA_BLOCK_HEADER + size);
+    if (!block)
+        return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    HARNESS_POISON(ARENA_BLOCK_DATA(block), size);
+
+    return block;
+}
+
+static void arena_block_delete(struct arena_block *block)
+{
+    HARNESS_UNPOISON(ARENA_BLOCK_DATA(block), block->size);
+    free(block);
+}
+
+void arena_init(struct arena *arena)
+{
+    arena->head = arena->current = NULL;
+    arena->used = arena->peak = arena->allocations = arena->requested = arena->refused = 0;
+    arena->limit = 0;
+}
+
+void arena_destroy(struct arena *arena)
+{
+    struct arena_block *block = arena->head;
+
+    while (block)
+    {
+        struct arena_block *next = block->next;
+        arena_block_delete(block);
+        block = next;
+    }
+
+    arena_init(arena);
+}
+
+// Releases everything at once. If the last input needed more than one block,
+// they are replaced by a single block big enough for it (up to a limit)
+void arena_reset(struct arena *arena)
+{
+    struct arena_block *block = arena->head;
+
+    if (block && block->next)
+    {
+        size_t size = 0;
+        for (; block; block = block->next)
+            size += block->size;
+
+        size_t limit = arena->limit;
+        arena_destroy(arena);
+        arena->limit = limit;
+
+        if (size > ARENA_RETAIN_MAX)
+            size = ARENA_RETAIN_MAX;
+        arena->head = arena->current = arena_block_new(size);
+    }
+    else if (block)
+    {
+        block->used = 0;
+        HARNESS_POISON(ARENA_BLOCK_DATA(block), block->size);
+    }
+
+    arena->used = arena->peak = arena->allocations = arena->requested = arena->refused = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    if (size > SIZE_MAX / 2)
+    {
+        arena->refused++;
+        return NULL;
+    }
+
+    size_t needed = ARENA_HEADER + align_up(size + arena_redzone(size));
+    struct arena_block *block = arena->current;
+
+    if (arena->limit && needed > arena->limit - arena->used)
+    {
+        arena->refused++;
+        return NULL;
+    }
+
+    // Blocks given back by arena_release() come first, the tail of a full
+    // block is left unused until the next reset
+    while (block && block->next && block->size - block->used < needed)
+        block = block->next;
+
+    if (!block || block->size - block->used < needed)
+    {
+        size_t block_size = block ? block->size * 2 : ARENA_BLOCK_MIN;
+        if (block_size < needed)
+            block_size = needed;
+
+        struct arena_block *fresh = arena_block_new(block_size);
+        if (!fresh)
+            return NULL;
+
+        if (block)
+            block->next = fresh;
+        else
+            arena->head = fresh;
+
+        block = fresh;
+    }
+    arena->current = block;
+
+    unsigned char *header = ARENA_BLOCK_DATA(block) + block->used;
+    unsigned char *ptr = header + ARENA_HEADER;
+
+    HARNESS_UNPOISON(header, ARENA_HEADER);
+    *(size_t *)header = needed;
+    HARNESS_POISON(header, ARENA_HEADER);
+    HARNESS_UNPOISON(ptr, size);
+
+    block->used += needed;
+    arena->used += needed;
+    arena->allocations++;
+    arena->requested += size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+
+    return ptr;
+}
+
+// Memory is only reclaimed by arena_reset(), except for the most recent
+// allocation which is rolled back so LIFO users (zlib) don't pile up. Under
+// ASan it is not handed out again, so that a use after free stays poisoned,
+// but `used` still gives it back so the limit and peak match other builds.
+void arena_free(struct arena *arena, void *ptr)
+{
+    struct arena_block *block = arena->current;
+    if (!ptr || !block)
+        return;
+
+    unsigned char *header = (unsigned char *)ptr - ARENA_HEADER;
+
+    HARNESS_UNPOISON(header, ARENA_HEADER);
+    size_t needed = *(size_t *)header;
+#ifdef HARNESS_ASAN
+    *(size_t *)header = 0; // Freed, `used` must not give it back twice
+#endif
+    HARNESS_POISON(header, ARENA_HEADER);
+
+    if (!needed)
+        return;
+
+    HARNESS_POISON(ptr, needed - ARENA_HEADER);
+
+    if (header + needed == ARENA_BLOCK_DATA(block) + block->used)
+    {
+#ifndef HARNESS_ASAN
+        block->used -= needed;
+#endif
+        arena->used -= needed;
+    }
+}
+
+void arena_mark(const struct arena *arena, struct arena_mark *mark)
+{
+    mark->block = arena->current;
+    mark->block_used = arena->current ? arena->current->used : 0;
+    mark->used = arena->used;
+}
+
+// The blocks stay linked after the mark's, empty, and arena_alloc() walks
+// through them before growing
+void arena_release(struct arena *arena, const struct arena_mark *mark)
+{
+    struct arena_block *block = mark->block ? mark->block : arena->head;
+
+    arena->current = block;
+    arena->used = mark->used;
+
+    for (size_t used = mark->block_used; block; block = block->next, used = 0)
+    {
+        block->used = used;
+        HARNESS_POISON(ARENA_BLOCK_DATA(block) + used, block->size - used);
+    }
+}
+
+png_voidp arena_png_malloc(png_structp png_ptr, png_alloc_size_t size)
+{
+    return arena_alloc((struct arena *)png_get_mem_ptr(png_ptr), size);
+}
+
+void arena_png_free(png_structp png_ptr, png_voidp ptr)
+{
+    arena_free((struct arena *)png_get_mem_ptr(png_ptr), ptr);
+}
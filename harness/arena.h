@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+// Bump-pointer allocator that owns every allocation made while processing
+// one input, libpng's included, and is reset wholesale afterwards.
+struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+struct arena
+{
+    struct arena_block *head;
+    struct arena_block *current;
+
+    size_t used;        // Bytes handed out for the current input, headers included
+    size_t peak;        // High-water mark of `used` for the current input
+    size_t allocations; // Allocations for the current input
+    size_t requested;   // Bytes asked for by the current input, frees included
+    size_t refused;     // Allocations refused for the current input
+
+    size_t limit; // Cap on `used`, 0 for none
+};
+
+// Where the arena stood, see arena_release()
+struct arena_mark
+{
+    struct arena_block *block;
+    size_t block_used;
+    size_t used;
+};
+
+void arena_init(struct arena *arena);
+void arena_destroy(struct arena *arena);
+void arena_reset(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_free(struct arena *arena, void *ptr);
+
+// Gives back everything allocated since arena_mark(), so that each stage of
+// an input gets the whole `limit`. The counters keep covering the input.
+void arena_mark(const struct arena *arena, struct arena_mark *mark);
+void arena_release(struct arena *arena, const struct arena_mark *mark);
+
+// libpng callbacks for png_create_*_struct_2(), the mem_ptr is the arena
+png_voidp arena_png_malloc(png_structp png_ptr, png_alloc_size_t size);
+void arena_png_free(png_structp png_ptr, png_voidp ptr);
@@ -0,0 +1,19 @@
+#pragma once
+
+// Manual poisoning for the harness's own allocators, no-ops without ASan
+#if defined(__SANITIZE_ADDRESS__)
+#define HARNESS_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define HARNESS_ASAN 1
+#endif
+#endif
+
+#ifdef HARNESS_ASAN
+#include <sanitizer/asan_interface.h>
+#define HARNESS_POISON(addr, size) ASAN_POISON_MEMORY_REGION(addr, size)
+#define HARNESS_UNPOISON(addr, size) ASAN_UNPOISON_MEMORY_REGION(addr, size)
+#else
+#define HARNESS_POISON(addr, size) ((void)(addr), (void)(size))
+#define HARNESS_UNPOISON(addr, size) ((void)(addr), (void)(size))
+#endif
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "watchdog.h"
+#include "input.h"
+#include "profile.h"
+
+// Replays a whole corpus on forked workers. Workers pull inputs from a cursor
+// in shared memory, so fast workers steal what slow ones have not reached yet.
+// A worker that dies mid-input is respawned and that input is marked crashed,
+// one that holds an input for longer than HARNESS_BATCH_TIMEOUT seconds (60 by
+// default, 0 for none) is killed and respawned, and the input marked timed out.
+#define BATCH_TIMEOUT_DEFAULT 60
+
+enum batch_status
+{
+    BATCH_PENDING,
+    BATCH_DONE,
+    BATCH_CRASHED,
+    BATCH_TIMEOUT,
+};
+
+struct batch_job
+{
+    enum batch_status status;
+    int code;       // Signal number or exit status of the crash
+    double seconds; // Wall time of the decode
+};
+
+struct batch_worker
+{
+    pid_t pid;
+    int current;    // Input being decoded, -1 when idle
+    unsigned long long started;
+    int killed;     // Input the parent killed it on, -1 for none
+};
+
+struct batch_shared
+{
+    int next;
+    unsigned long long rejections[GOVERNOR_REASONS];
+    struct watchdog_stats watchdog;
+};
+
+struct batch
+{
+    char **files;
+    int count;
+
+    struct batch_shared *shared;
+    struct batch_job *jobs;
+    struct batch_worker *workers;
+    unsigned nworkers;
+
+    unsigned long long timeout; // Nanoseconds an input may take, 0 for none
+};
+
+static unsigned long long batch_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Moves the worker's governor and watchdog counters to the shared ones, so a
+// worker that crashes later only loses those of the input it crashed on
+static void batch_publish(struct batch *batch)
+{
+    for (int reason = 0; reason < GOVERNOR_REASONS; reason++)
+        __atomic_fetch_add(&batch->shared->rejections[reason], governor_rejections[reason], __ATOMIC_RELAXED);
+    memset(governor_rejections, 0, sizeof(governor_rejections));
+
+    watchdog_merge(&batch->shared->watchdog, &watchdog_stats);
+    memset(&watchdog_stats, 0, sizeof(watchdog_stats));
+}
+
+static void batch_worker_main(struct batch *batch, struct batch_worker *worker)
+{
+    struct decode_ctx ctx;
+    int i;
+
+    // The row-band pool threads do not survive fork(), so set up after it
+    harness_init();
+    decode_ctx_init(&ctx, sink_mode_from_env(SINK_DISCARD), NULL);
+
+    while ((i = __atomic_fetch_add(&batch->shared->next, 1, __ATOMIC_RELAXED)) < batch->count)
+    {
+        struct batch_job *job = &batch->jobs[i];
+        struct input image;
+
+        // Profiling builds replay only what has no cached profile yet
+        if (profile_cached(batch->files[i]))
+        {
+            job->status = BATCH_DONE;
+            continue;
+        }
+
+        worker->started = batch_now();
+        __atomic_store_n(&worker->current, i, __ATOMIC_RELEASE);
+
+        if (!input_map(batch->files[i], &image))
+        {
+            profile_begin();
+            process_image(&ctx, image.data, image.size);
+            decode_ctx_reset(&ctx);
+            profile_end(batch->files[i]);
+            input_unmap(&image);
+        }
+
+        batch_publish(batch);
+
+        job->seconds = (batch_now() - worker->started) / 1e9;
+        job->status = BATCH_DONE;
+        __atomic_store_n(&worker->current, -1, __ATOMIC_RELEASE);
+    }
+
+    decode_ctx_free(&ctx);
+    band_free();
+
+    // exit() rather than _exit(), coverage builds dump their counters on the way out
+    exit(0);
+}
+
+static int batch_spawn(struct batch *batch, struct batch_worker *worker)
+{
+    worker->current = -1;
+    worker->killed = -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork()", none);
+
+    if (pid == 0)
+        batch_worker_main(batch, worker);
+
+    worker->pid = pid;
+    return 0;
+
+fail_none:
+    worker->pid = 0;
+    return 1;
+}
+
+// Reaps a worker, killing the ones that hold an input past the timeout meanwhile
+static pid_t batch_wait(struct batch *batch, int *status)
+{
+    pid_t pid;
+
+    while (!(pid = waitpid(-1, status, batch->timeout ? WNOHANG : 0)))
+    {
+        unsigned long long now = batch_now();
+
+        for (unsigned w = 0; w < batch->nworkers; w++)
+        {
+            struct batch_worker *worker = &batch->workers[w];
+            int current = __atomic_load_n(&worker->current, __ATOMIC_ACQUIRE);
+
+            if (worker->pid && worker->killed < 0 && current >= 0 && now - worker->started > batch->timeout)
+            {
+                worker->killed = current;
+                kill(worker->pid, SIGKILL);
+            }
+        }
+
+        struct timespec tick = {0, 10000000};
+        nanosleep(&tick, NULL);
+    }
+
+    return pid;
+}
+
+static void batch_report(struct batch *batch, double wall)
+{
+    double total = 0;
+    int crashed = 0, timed_out = 0, skipped = 0;
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        struct batch_job *job = &batch->jobs[i];
+
+        if (job->status == BATCH_DONE)
+        {
+            printf("batch: %10.3f ms  %s\n", job->seconds * 1e3, batch->files[i]);
+        }
+        else if (job->status == BATCH_CRASHED)
+        {
+            printf("batch: %10.3f ms  %s  CRASHED (%s %d)\n", job->seconds * 1e3, batch->files[i],
+                   job->code < 0 ? "signal" : "exit", abs(job->code));
+            crashed++;
+        }
+        else if (job->status == BATCH_TIMEOUT)
+        {
+            printf("batch: %10.3f ms  %s  TIMEOUT\n", job->seconds * 1e3, batch->files[i]);
+            timed_out++;
+        }
+        else
+        {
+            skipped++;
+        }
+
+        total += job->seconds;
+    }
+
+    printf("Batch: %d inputs (%d crashed, %d timed out, %d skipped) on %u workers in %.3fs, %.3fs of decoding\n",
+           batch->count, crashed, timed_out, skipped, batch->nworkers, wall, total);
+
+    for (int i = 0; i < batch->count; i++)
+        if (batch->jobs[i].status == BATCH_CRASHED)
+            printf("Crashed: %s\n", batch->files[i]);
+    for (int i = 0; i < batch->count; i++)
+        if (batch->jobs[i].status == BATCH_TIMEOUT)
+            printf("Timed out: %s\n", batch->files[i]);
+
+    memcpy(governor_rejections, batch->shared->rejections, sizeof(governor_rejections));
+    governor_report();
+    watchdog_stats = batch->shared->watchdog;
+    watchdog_report();
+}
+
+int replay_batch(unsigned workers, int count, char **args)
+{
+    struct batch batch = {0};
+    struct input_list list = {0};
+    int status, result = 1;
+    pid_t pid;
+
+    if (workers < 1)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *timeout = getenv("HARNESS_BATCH_TIMEOUT");
+    batch.timeout = (timeout ? strtoull(timeout, NULL, 0) : BATCH_TIMEOUT_DEFAULT) * 1000000000ull;
+
+    if (input_list_collect(&list, count, args))
+        goto fail_files;
+
+    if (!list.count)
+        fail("no inputs", files);
+
+    batch.files = list.files;
+    batch.count = list.count;
+
+    // Shared with the workers, their results survive them crashing
+    size_t size = sizeof(struct batch_shared) + batch.count * sizeof(struct batch_job) + workers * sizeof(struct batch_worker);
+    void *shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        fail("mmap()", files);
+
+    batch.shared = shared;
+    batch.jobs = (struct batch_job *)(batch.shared + 1);
+    batch.workers = (struct batch_worker *)(batch.jobs + batch.count);
+    batch.nworkers = workers < (unsigned)batch.count ? workers : (unsigned)batch.count;
+
+    unsigned long long start = batch_now();
+    unsigned running = 0;
+
+    for (unsigned w = 0; w < batch.nworkers; w++)
+        running += !batch_spawn(&batch, &batch.workers[w]);
+
+    while (running && (pid = batch_wait(&batch, &status)) > 0)
+    {
+        struct batch_worker *worker = NULL;
+        for (unsigned w = 0; w < batch.nworkers; w++)
+            if (batch.workers[w].pid == pid)
+                worker = &batch.workers[w];
+
+        if (!worker)
+            continue;
+
+        running--;
+        worker->pid = 0;
+
+        int current = __atomic_load_n(&worker->current, __ATOMIC_ACQUIRE);
+        if (current < 0)
+            continue;
+
+        // Died with an input in hand (sanitizers exit() rather than raise), or killed over it
+        struct batch_job *job = &batch.jobs[current];
+        job->status = current == worker->killed ? BATCH_TIMEOUT : BATCH_CRASHED;
+        job->code = WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+        job->seconds = (batch_now() - worker->started) / 1e9;
+        printf("batch: worker %d %s on %s\n", (int)pid, job->status == BATCH_TIMEOUT ? "timed out" : "crashed",
+               batch.files[current]);
+
+        if (__atomic_load_n(&batch.shared->next, __ATOMIC_RELAXED) < batch.count)
+            running += !batch_spawn(&batch, worker);
+    }
+
+    batch_report(&batch, (batch_now() - start) / 1e9);
+
+    result = 0;
+    for (int i = 0; i < batch.count; i++)
+        if (batch.jobs[i].status != BATCH_DONE)
+            result = 2;
+
+    munmap(shared, size);
+
+fail_files:
+    input_list_free(&list);
+    return result;
+}
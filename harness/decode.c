@@ -0,0 +1,461 @@
+/*
+ * A simple libpng example program
+ * http://zarb.org/~gc/html/libpng.html
+ *
+ * Modified by Yoshimasa Niwa to make it much simpler
+ * and support all defined color_type.
+ *
+ * Copyright 2002-2010 Guillaume Cottenceau.
+ *
+ * This software may be freely redistributed under the terms
+ * of the X11 license.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <png.h>
+
+#include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "input.h"
+#include "kernel.h"
+#include "pool.h"
+#include "watchdog.h"
+
+void decode_ctx_init(struct decode_ctx *ctx, enum sink_mode mode, const char *filename)
+{
+    ctx->width = ctx->height = 0;
+    ctx->color_type = ctx->bit_depth = 0;
+    ctx->row_pointers = NULL;
+
+    arena_init(&ctx->arena);
+    ctx->arena.limit = governor_limits.alloc;
+    slab_init(&ctx->slab);
+    sink_init(&ctx->sink, mode, filename);
+}
+
+// Forgets the current input. Its memory goes back to the arena in one go.
+void decode_ctx_reset(struct decode_ctx *ctx)
+{
+    ctx->width = ctx->height = 0;
+    ctx->row_pointers = NULL;
+
+    if (ctx->arena.refused)
+        governor_note(GOVERNOR_ALLOC);
+
+    arena_reset(&ctx->arena);
+    ctx->slab.size = 0; // Its memory is kept, but no image is left in it
+}
+
+void decode_ctx_free(struct decode_ctx *ctx)
+{
+    sink_free(&ctx->sink);
+    slab_free(&ctx->slab);
+    arena_destroy(&ctx->arena);
+}
+
+int read_user_chunk_callback(png_structp png_ptr, png_unknown_chunkp chunk)
+{
+    return 0;
+}
+
+// Set before png_read_info(), so that a gAMA chunk still overrides the file gamma
+void decode_set_gamma(png_structp png, const struct selector *selector)
+{
+    if (selector->transforms & SELECT_ALPHA_MODE)
+        png_set_alpha_mode(png, selector->alpha_mode, selector->alpha_gamma);
+
+    if (selector->transforms & SELECT_GAMMA)
+        png_set_gamma(png, selector->screen_gamma, selector->file_gamma);
+}
+
+// Read any color_type into 8bit depth, RGBA format.
+// See http://www.libpng.org/pub/png/libpng-manual.txt
+void decode_set_rgba(png_structp png, png_infop info, const struct selector *selector)
+{
+    png_byte color_type = png_get_color_type(png, info);
+    png_byte bit_depth = png_get_bit_depth(png, info);
+
+    if (bit_depth == 16)
+        png_set_strip_16(png);
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+
+    // PNG_COLOR_TYPE_GRAY_ALPHA is always 8 or 16bit depth.
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png);
+
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+
+    // These color_type don't have an alpha channel then fill it with 0xff.
+    if (color_type == PNG_COLOR_TYPE_RGB ||
+        color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+
+    if (color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png);
+
+    // Transforms are only accepted before png_read_update_info()
+    png_set_gray_to_rgb(png);
+    png_set_expand(png);
+    png_set_packing(png);
+    png_set_scale_16(png);
+    png_set_tRNS_to_alpha(png);
+
+    // Selected extras that keep the pixels 8bit RGBA
+    if (selector->transforms & SELECT_INVERT_MONO)
+        png_set_invert_mono(png);
+    if (selector->transforms & SELECT_INVERT_ALPHA)
+        png_set_invert_alpha(png);
+    if (selector->transforms & SELECT_SWAP_ALPHA)
+        png_set_swap_alpha(png);
+    if (selector->transforms & SELECT_BGR)
+        png_set_bgr(png);
+}
+
+int read_png_file(struct decode_ctx *ctx, const png_byte *data, size_t size, const struct selector *selector)
+{
+    struct input_reader reader;
+    int result = 1;
+    input_reader_init(&reader, data, size);
+
+    png_structp png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, governor_error_fn, governor_warning_fn,
+                                               &ctx->arena, arena_png_malloc, arena_png_free);
+    if (!png)
+        fail("png_create_read_struct_2()", none);
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+        fail("png_create_info_struct()", read_struct);
+
+    if (setjmp(png_jmpbuf(png)))
+        fail("setjmp(png_jmpbuf())", info_struct);
+
+    // png_set_read_user_chunk_fn(png, 0, read_user_chunk_callback);
+
+    png_set_read_fn(png, &reader, input_read_fn);
+    png_set_read_status_fn(png, watchdog_row_fn);
+    governor_apply(png);
+    decode_set_gamma(png, selector);
+    png_read_info(png, info);
+
+    png_uint_32 width = ctx->width = png_get_image_width(png, info);
+    png_uint_32 height = ctx->height = png_get_image_height(png, info);
+    ctx->color_type = png_get_color_type(png, info);
+    ctx->bit_depth = png_get_bit_depth(png, info);
+
+    if (governor_check_pixels(width, height))
+        fail("governor_check_pixels()", info_struct);
+
+    decode_set_rgba(png, info, selector);
+
+    // int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    if (ctx->row_pointers)
+        fail("row_pointers already allocated", info_struct);
+
+    // process_png_file() walks 8bit RGBA pixels
+    size_t rowbytes = png_get_rowbytes(png, info);
+    if (rowbytes < (size_t)width * 4)
+        fail("png_get_rowbytes() is not 8bit RGBA", info_struct);
+
+    png_bytep *row_pointers = (png_bytep *)arena_alloc(&ctx->arena, sizeof(png_bytep) * height);
+    if (!row_pointers)
+        fail("arena_alloc()", info_struct);
+
+    if (!slab_rows(&ctx->slab, row_pointers, height, rowbytes))
+        fail("slab_rows()", info_struct);
+
+    ctx->row_pointers = row_pointers;
+    // png_handler.row_ptr = png_malloc(
+    //     png_handler.png_ptr, png_get_rowbytes(png_handler.png_ptr,
+    //                                           png_handler.info_ptr));
+
+    // for (int pass = 0; pass < passes; ++pass)
+    // {
+    //     for (png_uint_32 y = 0; y < height; ++y)
+    //     {
+    //         png_read_row(png_handler.png_ptr,
+    //                      (png_bytep)(png_handler.row_ptr), 0);
+    //     }
+    // }
+
+    png_read_image(png, row_pointers);
+
+    // A lot of getters
+    png_get_x_offset_inches(png, info);
+    png_get_x_offset_inches_fixed(png, info);
+    png_get_x_offset_microns(png, info);
+    png_get_x_offset_pixels(png, info);
+    png_get_x_pixels_per_inch(png, info);
+    png_get_x_pixels_per_meter(png, info);
+    png_get_y_offset_inches(png, info);
+    png_get_y_offset_inches_fixed(png, info);
+    png_get_y_offset_microns(png, info);
+    png_get_y_offset_pixels(png, info);
+    png_get_y_pixels_per_inch(png, info);
+    png_get_y_pixels_per_meter(png, info);
+    png_get_filter_type(png, info);
+    png_get_x_pixels_per_meter(png, info);
+    png_get_y_pixels_per_meter(png, info);
+    png_get_pixels_per_meter(png, info);
+    png_get_pixel_aspect_ratio(png, info);
+    png_get_pixel_aspect_ratio_fixed (png, info);
+    png_get_x_offset_microns(png, info);
+    png_get_y_offset_microns(png, info);
+    png_get_x_offset_pixels(png, info);
+    png_get_y_offset_pixels(png, info);
+    png_get_pixels_per_inch(png, info);
+    png_get_x_pixels_per_inch(png, info);
+    png_get_y_pixels_per_inch(png, info);
+    png_get_x_offset_inches_fixed(png, info);
+    png_get_y_offset_inches_fixed(png, info);
+    png_get_x_offset_inches(png, info);
+    png_get_y_offset_inches(png, info);
+
+    result = 0;
+
+fail_info_struct:
+    png_destroy_read_struct(&png, &info, NULL);
+    goto fail_none;
+
+fail_read_struct:
+    png_destroy_read_struct(&png, NULL, NULL);
+
+fail_none:
+    return result;
+}
+
+void write_png_file(struct decode_ctx *ctx)
+{
+    png_structp png = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL,
+                                                &ctx->arena, arena_png_malloc, arena_png_free);
+    if (!png)
+        fail("png_create_write_struct_2()", none);
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+        fail("png_create_info_struct()", write_struct);
+
+    if (setjmp(png_jmpbuf(png)))
+        fail("setjmp(png_jmpbuf())", info_struct);
+
+    sink_begin(&ctx->sink);
+    png_set_write_fn(png, &ctx->sink, sink_write_fn, sink_flush_fn);
+    png_set_write_status_fn(png, watchdog_row_fn);
+
+    // Output is 8bit depth, RGBA format.
+    png_set_IHDR(
+        png,
+        info,
+        ctx->width, ctx->height,
+        8,
+        PNG_COLOR_TYPE_RGBA,
+        PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    // To remove the alpha channel for PNG_COLOR_TYPE_RGB format,
+    // Use png_set_filler().
+    // png_set_filler(png, 0, PNG_FILLER_AFTER);
+
+    if (!ctx->row_pointers)
+        fail("raw_pointers not allocated", info_struct);
+
+    png_write_image(png, ctx->row_pointers);
+    png_write_end(png, NULL);
+
+    sink_end(&ctx->sink, "write_png_file");
+
+fail_info_struct:
+    png_destroy_write_struct(&png, &info);
+    goto fail_none;
+
+fail_write_struct:
+    png_destroy_write_struct(&png, NULL);
+
+fail_none:
+    return;
+}
+
+// Decodes, thresholds and encodes one row at a time, so that every row is
+// still in cache when it is processed and compressed. Non-interlaced images
+// only ever need a single row. Interlaced ones are decoded whole first, since
+// every pass touches every row.
+int stream_png_file(struct decode_ctx *ctx, const png_byte *data, size_t size, const struct selector *selector)
+{
+    struct input_reader reader;
+    int result = 1;
+    input_reader_init(&reader, data, size);
+
+    png_structp png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, governor_error_fn, governor_warning_fn,
+                                               &ctx->arena, arena_png_malloc, arena_png_free);
+    if (!png)
+        fail("png_create_read_struct_2()", none);
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+        fail("png_create_info_struct()", read_struct);
+
+    png_structp out = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL,
+                                                &ctx->arena, arena_png_malloc, arena_png_free);
+    if (!out)
+        fail("png_create_write_struct_2()", info_struct);
+
+    png_infop out_info = png_create_info_struct(out);
+    if (!out_info)
+        fail("png_create_info_struct()", write_struct);
+
+    // Both structs bail out to the same place
+    if (setjmp(png_jmpbuf(png)))
+        fail("setjmp(png_jmpbuf(png))", out_info_struct);
+    if (setjmp(png_jmpbuf(out)))
+        fail("setjmp(png_jmpbuf(out))", out_info_struct);
+
+    png_set_read_fn(png, &reader, input_read_fn);
+    png_set_read_status_fn(png, watchdog_row_fn);
+    governor_apply(png);
+    decode_set_gamma(png, selector);
+    png_read_info(png, info);
+
+    png_uint_32 width = ctx->width = png_get_image_width(png, info);
+    png_uint_32 height = ctx->height = png_get_image_height(png, info);
+    ctx->color_type = png_get_color_type(png, info);
+    ctx->bit_depth = png_get_bit_depth(png, info);
+
+    if (governor_check_pixels(width, height))
+        fail("governor_check_pixels()", out_info_struct);
+
+    decode_set_rgba(png, info, selector);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    // The threshold kernel walks 8bit RGBA pixels
+    size_t rowbytes = png_get_rowbytes(png, info);
+    if (rowbytes < (size_t)width * 4)
+        fail("png_get_rowbytes() is not 8bit RGBA", out_info_struct);
+
+    // One row, or the whole image when there are passes to combine
+    png_uint_32 rows = passes > 1 ? height : 1;
+    png_bytep *row_pointers = (png_bytep *)arena_alloc(&ctx->arena, sizeof(png_bytep) * rows);
+    if (!row_pointers)
+        fail("arena_alloc()", out_info_struct);
+
+    if (!slab_rows(&ctx->slab, row_pointers, rows, rowbytes))
+        fail("slab_rows()", out_info_struct);
+
+    sink_begin(&ctx->sink);
+    png_set_write_fn(out, &ctx->sink, sink_write_fn, sink_flush_fn);
+    png_set_write_status_fn(out, watchdog_row_fn);
+
+    // Same output as write_png_file(): 8bit depth, RGBA format.
+    png_set_IHDR(out, out_info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(out, out_info);
+
+    if (passes > 1)
+        for (int pass = 0; pass < passes; pass++)
+            for (png_uint_32 y = 0; y < height; y++)
+                png_read_row(png, row_pointers[y], NULL);
+
+    for (png_uint_32 y = 0; y < height; y++)
+    {
+        png_bytep row = row_pointers[passes > 1 ? y : 0];
+
+        if (passes == 1)
+            png_read_row(png, row, NULL);
+
+        threshold_kernel.fn(row, width);
+        png_write_row(out, row);
+    }
+
+    png_write_end(out, NULL);
+    sink_end(&ctx->sink, "stream_png_file");
+    result = 0;
+
+fail_out_info_struct:
+    png_destroy_write_struct(&out, &out_info);
+    goto fail_info_struct;
+
+fail_write_struct:
+    png_destroy_write_struct(&out, NULL);
+
+fail_info_struct:
+    png_destroy_read_struct(&png, &info, NULL);
+    goto fail_none;
+
+fail_read_struct:
+    png_destroy_read_struct(&png, NULL, NULL);
+
+fail_none:
+    return result;
+}
+
+// Large images are split into cache-sized row bands for a worker pool.
+// HARNESS_THREADS=N enables it, HARNESS_THREADS_MIN_PIXELS sets the size
+// under which images stay serial to avoid paying for the synchronization.
+#define BAND_BYTES (256 << 10)
+
+static struct pool *band_pool;
+static unsigned long long band_min_pixels = 1 << 20;
+
+// HARNESS_STREAM=1 streams rows instead of the buffered passes, for every
+// input; selector inputs can also pick it one at a time
+int decode_stream;
+
+void band_init(void)
+{
+    const char *threads = getenv("HARNESS_THREADS");
+    const char *min_pixels = getenv("HARNESS_THREADS_MIN_PIXELS");
+    const char *stream = getenv("HARNESS_STREAM");
+
+    if (min_pixels)
+        band_min_pixels = strtoull(min_pixels, NULL, 0);
+
+    if (threads && atoi(threads) > 1 && !band_pool)
+    {
+        band_pool = pool_create(atoi(threads));
+        if (!band_pool)
+            printf("FAIL on %s: pool_create(), staying serial\n", __func__);
+    }
+
+    decode_stream = stream && atoi(stream) != 0;
+}
+
+void band_free(void)
+{
+    pool_destroy(band_pool);
+    band_pool = NULL;
+}
+
+static void process_rows(void *arg, size_t begin, size_t end)
+{
+    struct decode_ctx *ctx = arg;
+
+    // Grayscale + threshold each row with the kernel picked by kernel_init()
+    for (size_t y = begin; y < end; y++)
+        threshold_kernel.fn(ctx->row_pointers[y], ctx->width);
+}
+
+void process_png_file(struct decode_ctx *ctx)
+{
+    if (!ctx->row_pointers)
+        return;
+
+    if (!band_pool || (unsigned long long)ctx->width * ctx->height < band_min_pixels)
+    {
+        process_rows(ctx, 0, ctx->height);
+        return;
+    }
+
+    size_t band = BAND_BYTES / ((size_t)ctx->width * 4);
+    pool_run(band_pool, process_rows, ctx, ctx->height, band ? band : 1);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <png.h>
+
+#include "arena.h"
+#include "selector.h"
+#include "sink.h"
+#include "slab.h"
+
+// Everything needed to process inputs on one thread. Nothing in here is
+// shared, so any number of contexts can run concurrently.
+struct decode_ctx
+{
+    // The image decoded by read_png_file()
+    png_uint_32 width, height;
+    png_byte color_type;
+    png_byte bit_depth;
+    png_bytep *row_pointers;
+
+    struct arena arena; // Everything allocated for the current input
+    struct slab slab;   // Pixels, kept across inputs
+    struct sink sink;   // Encoded output
+};
+
+void decode_ctx_init(struct decode_ctx *ctx, enum sink_mode mode, const char *filename);
+void decode_ctx_reset(struct decode_ctx *ctx);
+void decode_ctx_free(struct decode_ctx *ctx);
+
+// Transforms shared by every pipeline that wants 8bit RGBA rows
+void decode_set_gamma(png_structp png, const struct selector *selector);
+void decode_set_rgba(png_structp png, png_infop info, const struct selector *selector);
+
+int read_png_file(struct decode_ctx *ctx, const png_byte *data, size_t size, const struct selector *selector);
+void process_png_file(struct decode_ctx *ctx);
+void write_png_file(struct decode_ctx *ctx);
+
+// read_png_file(), process_png_file() and write_png_file() a row at a time
+int stream_png_file(struct decode_ctx *ctx, const png_byte *data, size_t size, const struct selector *selector);
+extern int decode_stream;
+
+void band_init(void);
+void band_free(void);
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "decode.h"
+#include "input.h"
+#include "profile.h"
+
+// Corpus distillation. Every input runs once in this process, and the profile
+// counters it hits are its features. A weighted greedy set cover then keeps
+// inputs that still hit every feature, preferring small and fast ones.
+struct distill_input
+{
+    const char *file;
+    size_t size;
+    double seconds;
+    double cost;
+
+    uint32_t *features;
+    size_t count;
+    size_t gain; // Upper bound on the features it still adds
+};
+
+// Max-heap of inputs by gain / cost
+struct distill_heap
+{
+    struct distill_input **items;
+    size_t count;
+};
+
+static double distill_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int distill_before(const struct distill_input *a, const struct distill_input *b)
+{
+    return a->gain * b->cost > b->gain * a->cost;
+}
+
+static void heap_push(struct distill_heap *heap, struct distill_input *input)
+{
+    size_t i = heap->count++;
+
+    while (i && distill_before(input, heap->items[(i - 1) / 2]))
+    {
+        heap->items[i] = heap->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->items[i] = input;
+}
+
+static struct distill_input *heap_pop(struct distill_heap *heap)
+{
+    struct distill_input *top = heap->items[0], *last = heap->items[--heap->count];
+    size_t i = 0;
+
+    for (;;)
+    {
+        size_t child = i * 2 + 1;
+        if (child >= heap->count)
+            break;
+        if (child + 1 < heap->count && distill_before(heap->items[child + 1], heap->items[child]))
+            child++;
+        if (!distill_before(heap->items[child], last))
+            break;
+
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    if (heap->count)
+        heap->items[i] = last;
+
+    return top;
+}
+
+// Features of the input that was just replayed
+static int distill_features(struct distill_input *input, const uint64_t *counters, size_t ncounters)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < ncounters; i++)
+        count += counters[i] != 0;
+
+    input->features = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!input->features)
+        return 1;
+
+    for (size_t i = 0; i < ncounters; i++)
+        if (counters[i])
+            input->features[input->count++] = i;
+
+    input->gain = input->count;
+    return 0;
+}
+
+static int distill_copy(const char *file, const char *out_dir)
+{
+    struct input image;
+    char path[4096];
+
+    const char *name = strrchr(file, '/');
+    snprintf(path, sizeof(path), "%s/%s", out_dir, name ? name + 1 : file);
+
+    if (input_map(file, &image))
+        return 1;
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        fail("fopen()", image);
+
+    if (image.size && fwrite(image.data, 1, image.size, fp) != image.size)
+        fail("fwrite()", fp);
+
+    fclose(fp);
+    input_unmap(&image);
+    return 0;
+
+fail_fp:
+    fclose(fp);
+
+fail_image:
+    input_unmap(&image);
+    return 1;
+}
+
+int distill(const char *out_dir, int count, char **args)
+{
+    struct input_list list = {0};
+    struct distill_input *inputs = NULL;
+    struct distill_heap heap = {0};
+    struct decode_ctx ctx;
+    const uint64_t *counters;
+    uint8_t *covered = NULL;
+    size_t total_size = 0, kept_size = 0, features = 0;
+    double total_seconds = 0, kept_seconds = 0;
+    int kept = 0, result = 1;
+
+    size_t ncounters = profile_counters(&counters);
+    if (!ncounters)
+        fail("distilling needs a -DHARNESS_PROFILE build", none);
+
+    if (input_list_collect(&list, count, args))
+        goto fail_list;
+    if (!list.count)
+        fail("no inputs", list);
+
+    inputs = calloc(list.count, sizeof(struct distill_input));
+    covered = calloc(ncounters, 1);
+    heap.items = calloc(list.count, sizeof(struct distill_input *));
+    if (!inputs || !covered || !heap.items)
+        fail("calloc()", list);
+
+    harness_init();
+    decode_ctx_init(&ctx, SINK_DISCARD, NULL);
+
+    for (int i = 0; i < list.count; i++)
+    {
+        struct distill_input *input = &inputs[i];
+        struct input image;
+
+        input->file = list.files[i];
+        if (input_map(input->file, &image))
+            continue;
+
+        profile_begin();
+        double start = distill_now();
+        process_image(&ctx, image.data, image.size);
+        decode_ctx_reset(&ctx);
+        input->seconds = distill_now() - start;
+        input->size = image.size;
+        input_unmap(&image);
+
+        if (distill_features(input, counters, ncounters))
+            fail("malloc()", ctx);
+
+        total_size += input->size;
+        total_seconds += input->seconds;
+    }
+
+    // Size and time weigh the same, each relative to the corpus average
+    double mean_size = (double)total_size / list.count + 1;
+    double mean_seconds = total_seconds / list.count + 1e-9;
+    for (int i = 0; i < list.count; i++)
+    {
+        inputs[i].cost = inputs[i].size / mean_size + inputs[i].seconds / mean_seconds + 1e-3;
+        if (inputs[i].gain)
+            heap_push(&heap, &inputs[i]);
+    }
+
+    if (mkdir(out_dir, 0755) && access(out_dir, W_OK))
+        fail("mkdir()", ctx);
+
+    // Lazy greedy: gains only shrink, so a refreshed top that stays on top is the best pick
+    while (heap.count)
+    {
+        struct distill_input *input = heap_pop(&heap);
+
+        size_t gain = 0;
+        for (size_t f = 0; f < input->count; f++)
+            gain += !covered[input->features[f]];
+
+        if (!gain)
+            continue;
+
+        if (gain < input->gain)
+        {
+            input->gain = gain;
+            if (heap.count && distill_before(heap.items[0], input))
+            {
+                heap_push(&heap, input);
+                continue;
+            }
+        }
+
+        for (size_t f = 0; f < input->count; f++)
+            covered[input->features[f]] = 1;
+
+        if (distill_copy(input->file, out_dir))
+            fail("copying an input", ctx);
+
+        features += gain;
+        kept_size += input->size;
+        kept_seconds += input->seconds;
+        kept++;
+    }
+
+    printf("Distilled %d inputs (%zu bytes, %.3fs) to %d (%zu bytes, %.3fs) covering %zu of %zu counters in %s\n",
+           list.count, total_size, total_seconds, kept, kept_size, kept_seconds, features, ncounters, out_dir);
+    result = 0;
+
+fail_ctx:
+    decode_ctx_free(&ctx);
+    band_free();
+
+fail_list:
+    if (inputs)
+        for (int i = 0; i < list.count; i++)
+            free(inputs[i].features);
+    free(inputs);
+    free(covered);
+    free(heap.items);
+    input_list_free(&list);
+
+fail_none:
+    return result;
+}
@@ -4,10 +4,16 @@
 #include <setjmp.h>
 #include <png.h>
 
-#define ERROR
-#define OK
-#define open_file
-#define streams
+#include "arena.h"
+#include "governor.h"
+#include "input.h"
+#include "selector.h"
+#include "watchdog.h"
+
+#define ERROR 1
+#define OK 0
+#define from_memory
+#define no_streams
 #define single
 #define sparkle
 #define no_entire
@@ -15,38 +21,45 @@
 // user_error_fn
 void user_error_fn(png_structp png_ptr, png_const_charp error_msg)
 {
+    governor_classify(error_msg);
 }
 
 // user_warning_fn
 void user_warning_fn(png_structp png_ptr, png_const_charp warning_msg)
 {
+    governor_classify(warning_msg);
 }
 
-#ifdef open_file                    /* prototype 1 */
-void example1_main(char *file_name) /* We need to open the file */
+#ifdef from_memory                                         /* prototype 1 */
+int example1_main(const png_byte *data, size_t size, struct arena *arena,
+                  const struct selector *selector) /* The file is already in memory */
 {
     png_structp png_ptr;
     png_infop info_ptr;
     int sig_read = 0;
     png_uint_32 width, height = 0;
     int bit_depth, color_type, interlace_type;
-    FILE *fp;
+    struct input_reader user_io_ptr;
 
-    if ((fp = fopen(file_name, "rb")) == NULL)
-        return ERROR;
+    input_reader_init(&user_io_ptr, data, size);
 
-#elif defined no_open_file /* prototype 2 */
-void read_png(FILE *fp, int sig_read) /* File is already open */
+#elif defined no_from_memory /* prototype 2 */
+int read_png(FILE *fp, int sig_read) /* File is already open */
 {
     png_structp png_ptr;
     png_infop info_ptr;
     png_uint_32 width, height;
     int bit_depth, color_type, interlace_type;
-#endif                     // no_open_file /* Only use one prototype! */
+#endif                     // no_from_memory /* Only use one prototype! */
 
     double screen_gamma;
     png_voidp user_error_ptr = NULL;
-    png_bytep *row_pointers = NULL;
+    /* Read back after a longjmp(), so they must not live in registers.  The
+     * arena does not zero png_malloc() memory, so only the first
+     * allocated_rows entries of row_pointers are valid.
+     */
+    png_bytep *volatile row_pointers = NULL;
+    volatile png_uint_32 allocated_rows = 0;
 
     /* Create and initialize the png_struct with the desired error handler
      * functions.  If you want to use the default stderr and longjump method,
@@ -54,20 +67,23 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
      * the compiler header file version, so that we know if the application
      * was compiled with a compatible version of the library.  REQUIRED.
      */
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
-                                     user_error_ptr, user_error_fn, user_warning_fn);
+    png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+                                       user_error_ptr, user_error_fn, user_warning_fn,
+                                       arena, arena_png_malloc, arena_png_free);
 
     if (png_ptr == NULL)
-    {
-        fclose(fp);
         return ERROR;
-    }
+
+    /* Apply the harness's resource limits before anything is read, and
+     * check the stage's time budget after every row.
+     */
+    governor_apply(png_ptr);
+    png_set_read_status_fn(png_ptr, watchdog_row_fn);
 
     /* Allocate/initialize the memory for image information.  REQUIRED. */
     info_ptr = png_create_info_struct(png_ptr);
     if (info_ptr == NULL)
     {
-        fclose(fp);
         png_destroy_read_struct(&png_ptr, NULL, NULL);
         return ERROR;
     }
@@ -80,18 +96,14 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     {
         if (row_pointers)
         {
-            for (png_uint_32 row = 0; row < height; row++)
-            {
-                if (row_pointers[row] != NULL)
-                    png_free(png_ptr, row_pointers[row]);
-            }
+            for (png_uint_32 row = 0; row < allocated_rows; row++)
+                png_free(png_ptr, row_pointers[row]);
 
             png_free(png_ptr, row_pointers);
         }
 
         /* Free all of the memory associated with the png_ptr and info_ptr. */
         png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
         /* If we get here, we had a problem reading the file. */
         return ERROR;
     }
@@ -105,7 +117,7 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     /* If you are using replacement read functions, instead of calling
      * png_init_io(), you would call:
      */
-    png_set_read_fn(png_ptr, (void *)user_io_ptr, user_read_fn);
+    png_set_read_fn(png_ptr, (void *)&user_io_ptr, input_read_fn);
     /* where user_io_ptr is a structure you want available to the callbacks. */
 #endif                   // no_streams /* Use only one I/O method! */
 
@@ -133,49 +145,77 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
                  &interlace_type, NULL, NULL);
 
+    /* Don't bother with images that are too big to decode in time. */
+    if (governor_check_pixels(width, height))
+    {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return ERROR;
+    }
+
     /* Set up the data transformations you want.  Note that these are all
      * optional.  Only call them if you want/need them.  Many of the
      * transformations only work on specific types of images, and many
-     * are mutually exclusive.
+     * are mutually exclusive.  The selector picks which ones run.
      */
+    unsigned transforms = selector->transforms;
 
     /* Tell libpng to strip 16 bits/color files down to 8 bits/color.
      * Use accurate scaling if it's available, otherwise just chop off the
      * low byte.
      */
 #ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
-    png_set_scale_16(png_ptr);
+    if (transforms & SELECT_SCALE_16)
+        png_set_scale_16(png_ptr);
+    if (transforms & SELECT_STRIP_16)
 #else
-    png_set_strip_16(png_ptr);
+    if (transforms & (SELECT_SCALE_16 | SELECT_STRIP_16))
 #endif
+        png_set_strip_16(png_ptr);
+
+    /* Expand 8 bit channels (and everything smaller) to 16 bits. */
+    if (transforms & SELECT_EXPAND_16)
+        png_set_expand_16(png_ptr);
 
     /* Strip alpha bytes from the input data without combining with the
      * background (not recommended).
      */
-    png_set_strip_alpha(png_ptr);
+    if (transforms & SELECT_STRIP_ALPHA)
+        png_set_strip_alpha(png_ptr);
 
     /* Extract multiple pixels with bit depths of 1, 2 or 4 from a single
      * byte into separate bytes (useful for paletted and grayscale images).
      */
-    png_set_packing(png_ptr);
+    if (transforms & SELECT_PACKING)
+        png_set_packing(png_ptr);
 
     /* Change the order of packed pixels to least significant bit first
      * (not useful if you are using png_set_packing).
      */
-    png_set_packswap(png_ptr);
+    if (transforms & SELECT_PACKSWAP)
+        png_set_packswap(png_ptr);
 
     /* Expand paletted colors into true RGB triplets. */
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
+    if ((transforms & SELECT_PALETTE_TO_RGB) && color_type == PNG_COLOR_TYPE_PALETTE)
         png_set_palette_to_rgb(png_ptr);
 
     /* Expand grayscale images to the full 8 bits from 1, 2 or 4 bits/pixel. */
-    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+    if ((transforms & SELECT_EXPAND_GRAY) && color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
         png_set_expand_gray_1_2_4_to_8(png_ptr);
 
+    /* Expand everything (palette, low bit depth gray, tRNS) in one go. */
+    if (transforms & SELECT_EXPAND)
+        png_set_expand(png_ptr);
+
+    /* Expand grayscale images to RGB, or reduce RGB images to grayscale. */
+    if (transforms & SELECT_GRAY_TO_RGB)
+        png_set_gray_to_rgb(png_ptr);
+    if (transforms & SELECT_RGB_TO_GRAY)
+        png_set_rgb_to_gray(png_ptr, PNG_ERROR_ACTION_NONE, -1, -1);
+
     /* Expand paletted or RGB images with transparency to full alpha channels
      * so the data will be available as RGBA quartets.
      */
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) != 0)
+    if ((transforms & SELECT_TRNS_TO_ALPHA) && png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) != 0)
         png_set_tRNS_to_alpha(png_ptr);
 
     /* Set the background color to draw transparent and alpha images over.
@@ -184,14 +224,18 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
      * even if the PNG file supplies a background, you are not required to
      * use it - you should use the (solid) application background if it has one.
      */
-    png_color_16 my_background, *image_background;
+    png_color_16 my_background = {0, selector->level, selector->level, selector->level, selector->level};
+    png_color_16p image_background;
 
-    if (png_get_bKGD(png_ptr, info_ptr, &image_background) != 0)
-        png_set_background(png_ptr, image_background,
-                           PNG_BACKGROUND_GAMMA_FILE, 1, 1.0);
-    else
-        png_set_background(png_ptr, &my_background,
-                           PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
+    if (transforms & SELECT_BACKGROUND)
+    {
+        if (png_get_bKGD(png_ptr, info_ptr, &image_background) != 0)
+            png_set_background(png_ptr, image_background,
+                               PNG_BACKGROUND_GAMMA_FILE, 1, 1.0);
+        else
+            png_set_background(png_ptr, &my_background,
+                               PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
+    }
 
     /* Some suggestions as to how to get a screen gamma value.
      *
@@ -206,8 +250,9 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     // /* If we don't have another value */
     // else
     {
-        screen_gamma = PNG_DEFAULT_sRGB; /* A good guess for a PC monitor
-                                            in a dimly lit room */
+        screen_gamma = selector->screen_gamma; /* PNG_DEFAULT_sRGB is a good
+                                                  guess for a PC monitor in a
+                                                  dimly lit room */
         // screen_gamma = PNG_GAMMA_MAC_18 or 1.0; /* Good guesses for Mac
         //                                            systems */
     }
@@ -220,22 +265,27 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
 
     int intent;
 
-    if (png_get_sRGB(png_ptr, info_ptr, &intent) != 0)
-        png_set_gamma(png_ptr, screen_gamma, PNG_DEFAULT_sRGB);
-    else
+    if (transforms & SELECT_GAMMA)
     {
         double image_gamma;
-        if (png_get_gAMA(png_ptr, info_ptr, &image_gamma) != 0)
+
+        if (png_get_sRGB(png_ptr, info_ptr, &intent) != 0)
+            png_set_gamma(png_ptr, screen_gamma, PNG_DEFAULT_sRGB);
+        else if (png_get_gAMA(png_ptr, info_ptr, &image_gamma) != 0)
             png_set_gamma(png_ptr, screen_gamma, image_gamma);
         else
-            png_set_gamma(png_ptr, screen_gamma, 0.45455);
+            png_set_gamma(png_ptr, screen_gamma, selector->file_gamma);
     }
 
+    /* Tell libpng how alpha is to be encoded (straight or premultiplied). */
+    if (transforms & SELECT_ALPHA_MODE)
+        png_set_alpha_mode(png_ptr, selector->alpha_mode, selector->alpha_gamma);
+
 #ifdef PNG_READ_QUANTIZE_SUPPORTED
     /* Quantize RGB files down to 8-bit palette, or reduce palettes
      * to the number of colors available on your screen.
      */
-    if ((color_type & PNG_COLOR_MASK_COLOR) != 0)
+    if ((transforms & SELECT_QUANTIZE) && (color_type & PNG_COLOR_MASK_COLOR) != 0)
     {
         int num_palette;
         png_colorp palette;
@@ -261,13 +311,18 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
 #endif /* READ_QUANTIZE */
 
     /* Invert monochrome files to have 0 as white and 1 as black. */
-    png_set_invert_mono(png_ptr);
+    if (transforms & SELECT_INVERT_MONO)
+        png_set_invert_mono(png_ptr);
+
+    /* Invert the alpha channel so that 0 is opaque. */
+    if (transforms & SELECT_INVERT_ALPHA)
+        png_set_invert_alpha(png_ptr);
 
     /* If you want to shift the pixel values from the range [0,255] or
      * [0,65535] to the original [0,7] or [0,31], or whatever range the
      * colors were originally in:
      */
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_sBIT) != 0)
+    if ((transforms & SELECT_SHIFT) && png_get_valid(png_ptr, info_ptr, PNG_INFO_sBIT) != 0)
     {
         png_color_8p sig_bit_p;
         png_get_sBIT(png_ptr, info_ptr, &sig_bit_p);
@@ -275,24 +330,27 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     }
 
     /* Flip the RGB pixels to BGR (or RGBA to BGRA). */
-    if ((color_type & PNG_COLOR_MASK_COLOR) != 0)
+    if ((transforms & SELECT_BGR) && (color_type & PNG_COLOR_MASK_COLOR) != 0)
         png_set_bgr(png_ptr);
 
     /* Swap the RGBA or GA data to ARGB or AG (or BGRA to ABGR). */
-    png_set_swap_alpha(png_ptr);
+    if (transforms & SELECT_SWAP_ALPHA)
+        png_set_swap_alpha(png_ptr);
 
     /* Swap bytes of 16-bit files to least significant byte first. */
-    png_set_swap(png_ptr);
+    if (transforms & SELECT_SWAP)
+        png_set_swap(png_ptr);
 
     /* Add filler (or alpha) byte (before/after each RGB triplet). */
-    png_set_filler(png_ptr, 0xffff, PNG_FILLER_AFTER);
+    if (transforms & SELECT_FILLER)
+        png_set_filler(png_ptr, 0xffff, PNG_FILLER_AFTER);
 
 #ifdef PNG_READ_INTERLACING_SUPPORTED
     /* Turn on interlace handling.  REQUIRED if you are not using
      * png_read_image().  To see how to handle interlacing passes,
      * see the png_read_row() method below:
      */
-    int number_passes = png_set_interlace_handling(png_ptr);
+    int number_passes = transforms & SELECT_INTERLACE ? png_set_interlace_handling(png_ptr) : 1;
 #else         /* !READ_INTERLACING */
     int number_passes = 1;
 #endif        /* READ_INTERLACING */
@@ -306,10 +364,11 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     /* Allocate the memory to hold the image using the fields of info_ptr. */
     // for (png_uint_32 row = 0; row < height; row++)
     //     row_pointers[row] = NULL; /* Clear the pointer array */
-    row_pointers = (png_bytep *)malloc(sizeof(png_bytep) * height);
+    row_pointers = (png_bytep *)png_malloc(png_ptr, sizeof(png_bytep) * height);
     for (png_uint_32 row = 0; row < height; row++)
     {
         row_pointers[row] = png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
+        allocated_rows = row + 1;
         // printf("row_pointers[%d] = %p\n", row, row_pointers[row]);
     }
 
@@ -366,9 +425,6 @@ void read_png(FILE *fp, int sig_read) /* File is already open */
     // for (png_uint_32 row = 0; row < height; row++)
     //     png_free(png_ptr, row_pointers[row]);
 
-    /* Close the file. */
-    fclose(fp);
-
     /* That's it! */
     return OK;
 }
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "governor.h"
+
+struct governor_limits governor_limits = {
+    .width = PNG_USER_WIDTH_MAX,
+    .height = PNG_USER_HEIGHT_MAX,
+    .pixels = 16000000,
+    .chunk = PNG_USER_CHUNK_MALLOC_MAX,
+    .cache = PNG_USER_CHUNK_CACHE_MAX,
+    .alloc = 256 << 20,
+};
+
+unsigned long long governor_rejections[GOVERNOR_REASONS];
+
+static const char *governor_names[GOVERNOR_REASONS] = {
+    [GOVERNOR_PIXELS] = "pixels",
+    [GOVERNOR_DIMENSIONS] = "dimensions",
+    [GOVERNOR_CHUNK] = "chunk",
+    [GOVERNOR_CACHE] = "cache",
+    [GOVERNOR_ALLOC] = "alloc",
+};
+
+void governor_init(void)
+{
+    const char *spec = getenv("HARNESS_LIMITS");
+    if (!spec)
+        return;
+
+    char *copy = strdup(spec), *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (!value)
+        {
+            printf("Ignoring malformed limit %s\n", item);
+            continue;
+        }
+        *value++ = '\0';
+
+        unsigned long long n = strtoull(value, NULL, 0);
+        if (!strcmp(item, "width"))
+            governor_limits.width = n;
+        else if (!strcmp(item, "height"))
+            governor_limits.height = n;
+        else if (!strcmp(item, "pixels"))
+            governor_limits.pixels = n;
+        else if (!strcmp(item, "chunk"))
+            governor_limits.chunk = n;
+        else if (!strcmp(item, "cache"))
+            governor_limits.cache = n;
+        else if (!strcmp(item, "alloc"))
+            governor_limits.alloc = n;
+        else
+            printf("Ignoring unknown limit %s\n", item);
+    }
+    free(copy);
+}
+
+void governor_report(void)
+{
+    printf("Governor rejections:");
+    for (int i = 0; i < GOVERNOR_REASONS; i++)
+        printf(" %s=%llu", governor_names[i], governor_rejections[i]);
+    printf("\n");
+}
+
+void governor_apply(png_structp png_ptr)
+{
+    png_set_user_limits(png_ptr, governor_limits.width, governor_limits.height);
+    png_set_chunk_malloc_max(png_ptr, governor_limits.chunk);
+    png_set_chunk_cache_max(png_ptr, governor_limits.cache);
+}
+
+// Returns non-zero if the image is too big to be worth decoding
+int governor_check_pixels(png_uint_32 width, png_uint_32 height)
+{
+    if ((unsigned long long)width * height <= governor_limits.pixels)
+        return 0;
+
+    governor_note(GOVERNOR_PIXELS);
+    return 1;
+}
+
+// Called from any decoding thread
+void governor_note(enum governor_reason reason)
+{
+    __atomic_fetch_add(&governor_rejections[reason], 1, __ATOMIC_RELAXED);
+}
+
+// libpng only reports its own limits through messages. Its "insufficient
+// memory" is left out: when the arena refused, decode_ctx_reset() already
+// notes it as GOVERNOR_ALLOC
+void governor_classify(png_const_charp message)
+{
+    if (strstr(message, "exceeds user limit"))
+        governor_note(GOVERNOR_DIMENSIONS);
+    else if (strstr(message, "chunk cache"))
+        governor_note(GOVERNOR_CACHE);
+    else if (strstr(message, "too large") || strstr(message, "application limits"))
+        governor_note(GOVERNOR_CHUNK);
+}
+
+void governor_error_fn(png_structp png_ptr, png_const_charp message)
+{
+    governor_classify(message);
+    fprintf(stderr, "libpng error: %s\n", message);
+    png_longjmp(png_ptr, 1);
+}
+
+void governor_warning_fn(png_structp png_ptr, png_const_charp message)
+{
+    governor_classify(message);
+    fprintf(stderr, "libpng warning: %s\n", message);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+// Resource limits shared by every decode path, so that memory and time
+// bombs are rejected early instead of eating the whole execution budget.
+// Set with HARNESS_LIMITS="pixels=N,width=N,height=N,chunk=N,cache=N,alloc=N"
+struct governor_limits
+{
+    png_uint_32 width;          // png_set_user_limits()
+    png_uint_32 height;         // png_set_user_limits()
+    unsigned long long pixels;  // width * height, checked once IHDR is known
+    png_alloc_size_t chunk;     // png_set_chunk_malloc_max()
+    png_uint_32 cache;          // png_set_chunk_cache_max()
+    size_t alloc;               // Arena bytes per pipeline
+};
+
+enum governor_reason
+{
+    GOVERNOR_PIXELS,
+    GOVERNOR_DIMENSIONS,
+    GOVERNOR_CHUNK,
+    GOVERNOR_CACHE,
+    GOVERNOR_ALLOC,
+    GOVERNOR_REASONS,
+};
+
+extern struct governor_limits governor_limits;
+extern unsigned long long governor_rejections[GOVERNOR_REASONS];
+
+void governor_init(void);
+void governor_report(void);
+
+void governor_apply(png_structp png_ptr);
+int governor_check_pixels(png_uint_32 width, png_uint_32 height);
+void governor_note(enum governor_reason reason);
+void governor_classify(png_const_charp message);
+
+// libpng error/warning callbacks that count limit hits, then behave as the defaults
+void governor_error_fn(png_structp png_ptr, png_const_charp message);
+void governor_warning_fn(png_structp png_ptr, png_const_charp message);
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "input.h"
+#include "watchdog.h"
+
+int input_map(const char *filename, struct input *input)
+{
+    struct stat st;
+    void *data;
+
+    input->data = NULL;
+    input->size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        fail("open()", none);
+
+    if (fstat(fd, &st) != 0)
+        fail("fstat()", fd);
+
+    // mmap() refuses empty mappings, an empty input is simply a NULL buffer
+    if (st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            fail("mmap()", fd);
+
+        input->data = data;
+        input->size = st.st_size;
+    }
+
+    close(fd);
+    return 0;
+
+fail_fd:
+    close(fd);
+
+fail_none:
+    return 1;
+}
+
+void input_unmap(struct input *input)
+{
+    if (input->data)
+        munmap((void *)input->data, input->size);
+
+    input->data = NULL;
+    input->size = 0;
+}
+
+void input_reader_init(struct input_reader *reader, const png_byte *data, size_t size)
+{
+    reader->data = data;
+    reader->size = size;
+    reader->offset = 0;
+}
+
+void input_read_fn(png_structp png_ptr, png_bytep out, size_t length)
+{
+    struct input_reader *reader = (struct input_reader *)png_get_io_ptr(png_ptr);
+
+    // Every chunk is read through here, as good a place as any to watch the clock
+    watchdog_check(png_ptr);
+
+    if (length > reader->size - reader->offset)
+        png_error(png_ptr, "Read Error");
+
+    memcpy(out, reader->data + reader->offset, length);
+    reader->offset += length;
+}
+
+static int input_list_add(struct input_list *list, const char *file)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        char **files = realloc(list->files, capacity * sizeof(char *));
+        if (!files)
+            fail("realloc()", none);
+
+        list->files = files;
+        list->capacity = capacity;
+    }
+
+    list->files[list->count] = strdup(file);
+    if (!list->files[list->count])
+        fail("strdup()", none);
+
+    list->count++;
+    return 0;
+
+fail_none:
+    return 1;
+}
+
+static int input_list_add_dir(struct input_list *list, const char *dir)
+{
+    struct dirent **entries;
+    struct stat st;
+    char path[4096];
+    int result = 0;
+
+    // Sorted, so that runs over the same directory are comparable
+    int n = scandir(dir, &entries, NULL, alphasort);
+    if (n < 0)
+        fail("scandir()", none);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (entries[i]->d_name[0] != '.' && !result)
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+            if (!stat(path, &st) && S_ISREG(st.st_mode))
+                result = input_list_add(list, path);
+        }
+        free(entries[i]);
+    }
+
+    free(entries);
+    return result;
+
+fail_none:
+    return 1;
+}
+
+static int input_list_add_file(struct input_list *list, const char *filename)
+{
+    char line[4096];
+    int result = 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        fail("fopen()", none);
+
+    while (!result && fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            result = input_list_add(list, line);
+    }
+
+    fclose(fp);
+    return result;
+
+fail_none:
+    return 1;
+}
+
+int input_list_collect(struct input_list *list, int count, char **args)
+{
+    struct stat st;
+
+    for (int i = 0; i < count; i++)
+    {
+        int result;
+
+        if (args[i][0] == '@')
+            result = input_list_add_file(list, args[i] + 1);
+        else if (!stat(args[i], &st) && S_ISDIR(st.st_mode))
+            result = input_list_add_dir(list, args[i]);
+        else
+            result = input_list_add(list, args[i]);
+
+        if (result)
+            return 1;
+    }
+
+    return 0;
+}
+
+void input_list_free(struct input_list *list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->files[i]);
+    free(list->files);
+
+    list->files = NULL;
+    list->count = list->capacity = 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+// An input file, loaded once and shared by every pipeline
+struct input
+{
+    const png_byte *data;
+    size_t size;
+};
+
+// Read cursor over an input, handed to libpng as the io_ptr
+struct input_reader
+{
+    const png_byte *data;
+    size_t size;
+    size_t offset;
+};
+
+int input_map(const char *filename, struct input *input);
+void input_unmap(struct input *input);
+
+void input_reader_init(struct input_reader *reader, const png_byte *data, size_t size);
+void input_read_fn(png_structp png_ptr, png_bytep out, size_t length);
+
+// Files to replay: <dir> adds every regular file in it (sorted), @<list> every
+// line of <list>, anything else is taken as an input file
+struct input_list
+{
+    char **files;
+    int count;
+    int capacity;
+};
+
+int input_list_collect(struct input_list *list, int count, char **args);
+void input_list_free(struct input_list *list);
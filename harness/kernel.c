@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNEL_X86 1
+#endif
+
+struct threshold_kernel threshold_kernel = {"scalar", threshold_scalar};
+
+void threshold_scalar(uint8_t *rgba, size_t pixels)
+{
+    for (size_t x = 0; x < pixels; x++)
+    {
+        uint8_t *px = &rgba[x * 4];
+
+        // Calculate the grayscale value
+        uint8_t newpx = (px[0] + px[1] + px[2]) / 3;
+
+        // Threshold the grayscale value (100% contrast)
+        if (newpx < 128)
+            newpx = 0;
+        else
+            newpx = 255;
+
+        // Set the new pixel value
+        px[0] = px[1] = px[2] = newpx;
+    }
+}
+
+#ifdef KERNEL_X86
+// (r + g + b) / 3 >= 128 is exactly r + g + b > 383, so each pixel is one
+// 32-bit lane: sum the three low bytes, compare, and blend the alpha back in.
+
+__attribute__((target("sse2"))) void threshold_sse2(uint8_t *rgba, size_t pixels)
+{
+    const __m128i byte = _mm_set1_epi32(0xff);
+    const __m128i limit = _mm_set1_epi32(383);
+    const __m128i color = _mm_set1_epi32(0x00ffffff);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    size_t x = 0;
+
+    for (; x + 4 <= pixels; x += 4)
+    {
+        __m128i *p = (__m128i *)&rgba[x * 4];
+        __m128i v = _mm_loadu_si128(p);
+
+        __m128i r = _mm_and_si128(v, byte);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), byte);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), byte);
+        __m128i on = _mm_cmpgt_epi32(_mm_add_epi32(_mm_add_epi32(r, g), b), limit);
+
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(on, color), _mm_and_si128(v, alpha)));
+    }
+
+    threshold_scalar(&rgba[x * 4], pixels - x);
+}
+
+__attribute__((target("avx2"))) void threshold_avx2(uint8_t *rgba, size_t pixels)
+{
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i limit = _mm256_set1_epi32(383);
+    const __m256i color = _mm256_set1_epi32(0x00ffffff);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+    size_t x = 0;
+
+    // Two vectors (16 pixels) per iteration to hide the load latency
+    for (; x + 16 <= pixels; x += 16)
+    {
+        __m256i *p = (__m256i *)&rgba[x * 4];
+        __m256i v0 = _mm256_loadu_si256(p);
+        __m256i v1 = _mm256_loadu_si256(p + 1);
+
+        __m256i s0 = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(v0, byte),
+                                                       _mm256_and_si256(_mm256_srli_epi32(v0, 8), byte)),
+                                      _mm256_and_si256(_mm256_srli_epi32(v0, 16), byte));
+        __m256i s1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(v1, byte),
+                                                       _mm256_and_si256(_mm256_srli_epi32(v1, 8), byte)),
+                                      _mm256_and_si256(_mm256_srli_epi32(v1, 16), byte));
+
+        __m256i on0 = _mm256_cmpgt_epi32(s0, limit);
+        __m256i on1 = _mm256_cmpgt_epi32(s1, limit);
+
+        _mm256_storeu_si256(p, _mm256_or_si256(_mm256_and_si256(on0, color), _mm256_and_si256(v0, alpha)));
+        _mm256_storeu_si256(p + 1, _mm256_or_si256(_mm256_and_si256(on1, color), _mm256_and_si256(v1, alpha)));
+    }
+
+    threshold_sse2(&rgba[x * 4], pixels - x);
+}
+#endif
+
+static const struct threshold_kernel threshold_kernels[] = {
+#ifdef KERNEL_X86
+    {"avx2", threshold_avx2},
+    {"sse2", threshold_sse2},
+#endif
+    {"scalar", threshold_scalar},
+};
+
+static int kernel_supported(const char *name)
+{
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if (!strcmp(name, "sse2"))
+        return __builtin_cpu_supports("sse2");
+#endif
+    return !strcmp(name, "scalar");
+}
+
+void kernel_init(void)
+{
+    const char *wanted = getenv("HARNESS_KERNEL");
+    size_t count = sizeof(threshold_kernels) / sizeof(threshold_kernels[0]);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct threshold_kernel *kernel = &threshold_kernels[i];
+
+        if (wanted && strcmp(wanted, kernel->name))
+            continue;
+
+        if (kernel_supported(kernel->name))
+        {
+            threshold_kernel = *kernel;
+            return;
+        }
+    }
+
+    if (wanted)
+        printf("HARNESS_KERNEL=%s is not available, using %s\n", wanted, threshold_kernel.name);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Grayscale + threshold (100% contrast) of 8bit RGBA pixels, in place.
+// Alpha is left alone. Every variant gives bit-exact scalar results.
+typedef void (*threshold_fn)(uint8_t *rgba, size_t pixels);
+
+struct threshold_kernel
+{
+    const char *name;
+    threshold_fn fn;
+};
+
+extern struct threshold_kernel threshold_kernel;
+
+// Picks the best kernel for this CPU, HARNESS_KERNEL=scalar|sse2|avx2 overrides
+void kernel_init(void);
+
+void threshold_scalar(uint8_t *rgba, size_t pixels);
+#if defined(__x86_64__) || defined(__i386__)
+void threshold_sse2(uint8_t *rgba, size_t pixels);
+void threshold_avx2(uint8_t *rgba, size_t pixels);
+#endif
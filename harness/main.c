@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <stdio.h>
 #include <png.h>
@@ -25,278 +26,32 @@
 #include <sys/mman.h>
 
 #include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "input.h"
+#include "watchdog.h"
 
-static int width, height;
-static png_byte color_type;
-static png_byte bit_depth;
-static png_bytep *row_pointers = NULL;
+static struct decode_ctx persistent_ctx;
+static int persistent_ready;
 
-#define fail(msg, label)                                                                  \
-    {                                                                                     \
-        printf("FAIL on %s:%llu: %s\n", (__func__), (unsigned long long)(__LINE__), msg); \
-        goto fail_##label;                                                                \
-    }
-
-// Progressive functions
-void progressive_info_callback(png_structp png_ptr, png_infop info_ptr)
-{
-}
-void progressive_row_callback(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num, int pass)
-{
-}
-void progressive_end_callback(png_structp png_ptr, png_infop info_ptr)
-{
-}
-int read_user_chunk_callback(png_structp png_ptr, png_unknown_chunkp chunk)
-{
-    return 0;
-}
-
-// int read_png_file(const uint8_t *data, size_t size)
-// {
-//     FILE *fp = fmemopen((uint8_t *)data, size, "rb");
-
-int read_png_file(char *filename)
-{
-    FILE *fp = fopen(filename, "rb");
-    if (!fp)
-        fail("fopen()", none);
-
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png)
-        fail("png_create_read_struct()", fp);
-
-    png_infop info = png_create_info_struct(png);
-    if (!info)
-        fail("png_create_info_struct()", read_struct);
-
-    if (setjmp(png_jmpbuf(png)))
-        fail("setjmp(png_jmpbuf())", info_struct);
-
-    // png_set_read_user_chunk_fn(png, 0, read_user_chunk_callback);
-
-    png_init_io(png, fp);
-    png_set_alpha_mode_fixed(png, PNG_ALPHA_PNG, PNG_ALPHA_OPTIMIZED);
-
-    png_set_gamma(png, 1, PNG_GAMMA_MAC_18);
-    png_read_info(png, info);
-
-    width = png_get_image_width(png, info);
-    height = png_get_image_height(png, info);
-    color_type = png_get_color_type(png, info);
-    bit_depth = png_get_bit_depth(png, info);
-
-    // Read any color_type into 8bit depth, RGBA format.
-    // See http://www.libpng.org/pub/png/libpng-manual.txt
-
-    if (bit_depth == 16)
-        png_set_strip_16(png);
-
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_palette_to_rgb(png);
-
-    // PNG_COLOR_TYPE_GRAY_ALPHA is always 8 or 16bit depth.
-    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
-        png_set_expand_gray_1_2_4_to_8(png);
-
-    if (png_get_valid(png, info, PNG_INFO_tRNS))
-        png_set_tRNS_to_alpha(png);
-
-    // These color_type don't have an alpha channel then fill it with 0xff.
-    if (color_type == PNG_COLOR_TYPE_RGB ||
-        color_type == PNG_COLOR_TYPE_GRAY ||
-        color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
-
-    if (color_type == PNG_COLOR_TYPE_GRAY ||
-        color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-        png_set_gray_to_rgb(png);
-
-    // int passes = png_set_interlace_handling(png);
-    png_read_update_info(png, info);
-
-    if (row_pointers)
-        fail("row_pointers already allocated", info_struct);
-
-    printf("AAAAAAAAAAAAAAAAAAA\n");
-    row_pointers = (png_bytep *)malloc(sizeof(png_bytep) * height);
-    for (int y = 0; y < height; y++)
-    {
-        row_pointers[y] = (png_byte *)malloc(png_get_rowbytes(png, info));
-    }
-    // png_handler.row_ptr = png_malloc(
-    //     png_handler.png_ptr, png_get_rowbytes(png_handler.png_ptr,
-    //                                           png_handler.info_ptr));
-
-    // for (int pass = 0; pass < passes; ++pass)
-    // {
-    //     for (png_uint_32 y = 0; y < height; ++y)
-    //     {
-    //         png_read_row(png_handler.png_ptr,
-    //                      (png_bytep)(png_handler.row_ptr), 0);
-    //     }
-    // }
-
-    png_set_gray_to_rgb(png);
-    png_set_expand(png);
-    png_set_packing(png);
-    png_set_scale_16(png);
-    png_set_tRNS_to_alpha(png);
-
-    png_read_image(png, row_pointers);
-
-    // A lot of getters
-    png_get_x_offset_inches(png, info);
-    png_get_x_offset_inches_fixed(png, info);
-    png_get_x_offset_microns(png, info);
-    png_get_x_offset_pixels(png, info);
-    png_get_x_pixels_per_inch(png, info);
-    png_get_x_pixels_per_meter(png, info);
-    png_get_y_offset_inches(png, info);
-    png_get_y_offset_inches_fixed(png, info);
-    png_get_y_offset_microns(png, info);
-    png_get_y_offset_pixels(png, info);
-    png_get_y_pixels_per_inch(png, info);
-    png_get_y_pixels_per_meter(png, info);
-    png_get_filter_type(png, info);
-    png_get_x_pixels_per_meter(png, info);
-    png_get_y_pixels_per_meter(png, info);
-    png_get_pixels_per_meter(png, info);
-    png_get_pixel_aspect_ratio(png, info);
-    png_get_pixel_aspect_ratio_fixed (png, info);
-    png_get_x_offset_microns(png, info);
-    png_get_y_offset_microns(png, info);
-    png_get_x_offset_pixels(png, info);
-    png_get_y_offset_pixels(png, info);
-    png_get_pixels_per_inch(png, info);
-    png_get_x_pixels_per_inch(png, info);
-    png_get_y_pixels_per_inch(png, info);
-    png_get_x_offset_inches_fixed(png, info);
-    png_get_y_offset_inches_fixed(png, info);
-    png_get_x_offset_inches(png, info);
-    png_get_y_offset_inches(png, info);
-
-    // // Set up the progressive reader
-    // png_set_progressive_read_fn(png, 0,
-    //                             progressive_info_callback, progressive_row_callback, progressive_end_callback);
-    // png_get_progressive_ptr(png);
-
-fail_info_struct:
-    png_destroy_read_struct(&png, &info, NULL);
-    goto fail_fp;
-
-fail_read_struct:
-    png_destroy_read_struct(&png, NULL, NULL);
-
-fail_fp:
-    fclose(fp);
-
-fail_none:
-    return 1;
-}
-
-void write_png_file(char *filename)
+// Persistent mode entry point, the input is processed straight from memory
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp)
-        fail("fopen()", none);
-
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png)
-        fail("png_create_write_struct()", fp);
-
-    png_infop info = png_create_info_struct(png);
-    if (!info)
-        fail("png_create_info_struct()", write_struct);
-
-    if (setjmp(png_jmpbuf(png)))
-        fail("setjmp(png_jmpbuf())", info_struct);
-
-    png_init_io(png, fp);
-
-    // Output is 8bit depth, RGBA format.
-    png_set_IHDR(
-        png,
-        info,
-        width, height,
-        8,
-        PNG_COLOR_TYPE_RGBA,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(png, info);
-
-    // To remove the alpha channel for PNG_COLOR_TYPE_RGB format,
-    // Use png_set_filler().
-    // png_set_filler(png, 0, PNG_FILLER_AFTER);
-
-    if (!row_pointers)
-        fail("raw_pointers not allocated", info_struct);
-
-    png_write_image(png, row_pointers);
-    png_write_end(png, NULL);
-
-    for (int y = 0; y < height; y++)
+    if (!persistent_ready)
     {
-        free(row_pointers[y]);
+        harness_init();
+        decode_ctx_init(&persistent_ctx, sink_mode_from_env(SINK_DISCARD), NULL);
+        persistent_ready = 1;
     }
-    free(row_pointers);
 
-fail_info_struct:
-    png_destroy_write_struct(&png, &info);
-    goto fail_fp;
-
-fail_write_struct:
-    png_destroy_write_struct(&png, NULL);
-
-fail_fp:
-    fclose(fp);
-
-fail_none:
-    return;
-}
-
-void process_png_file()
-{
-    for (int y = 0; y < height; y++)
-    {
-        png_bytep row = row_pointers[y];
-        for (int x = 0; x < width; x++)
-        {
-            png_bytep px = &(row[x * 4]);
-            // Do something awesome for each pixel here...
-            // printf("%4d, %4d = RGBA(%3d, %3d, %3d, %3d)\n", x, y, px[0], px[1], px[2], px[3]);
-
-            // Calculate the grayscale value
-            png_byte newpx = (px[0] + px[1] + px[2]) / 3;
-
-            // Threshold the grayscale value (100% contrast)
-            if (newpx < 128)
-                newpx = 0;
-            else
-                newpx = 255;
-
-            // Set the new pixel value
-            px[0] = px[1] = px[2] = newpx;
-        }
-    }
+    process_image(&persistent_ctx, data, size);
+    decode_ctx_reset(&persistent_ctx);
+    return 0;
 }
 
-void process_image(char *input_filename, char *output_filename)
-{
-
-    // Perform the processing of the pngtopng code
-    const char *argv[3] = {"1337", input_filename, output_filename};
-    pngtopng_main(3, argv);
-
-    // Perform the processing of the example1 code
-    example1_main(input_filename);
-
-    // Peform our processing
-    read_png_file(input_filename);
-    process_png_file();
-    write_png_file(output_filename);
-}
+#ifdef HARNESS_PERSISTENT
+extern void HF_ITER(const uint8_t **buf_ptr, size_t *len_ptr);
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -309,6 +64,36 @@ int main(int argc, char *argv[])
 
     char *input = NULL, *output = NULL;
 
+#ifdef HARNESS_PERSISTENT
+    // Without arguments, keep fetching inputs from honggfuzz (-P)
+    if (argc == 1)
+    {
+        for (;;)
+        {
+            const uint8_t *buf;
+            size_t len;
+
+            HF_ITER(&buf, &len);
+            LLVMFuzzerTestOneInput(buf, len);
+        }
+    }
+#endif
+
+    if (argc >= 3 && !strcmp(argv[1], "--threads"))
+    {
+        harness_init();
+        int result = replay_threads(atoi(argv[2]), argc - 3, argv + 3);
+        band_free();
+        return result;
+    }
+
+    // Workers set themselves up after fork(), see batch.c
+    if (argc >= 3 && !strcmp(argv[1], "--batch"))
+        return replay_batch(atoi(argv[2]), argc - 3, argv + 3);
+
+    if (argc >= 4 && !strcmp(argv[1], "--distill"))
+        return distill(argv[2], argc - 3, argv + 3);
+
     if (argc == 2)
     {
         input = argv[1];
@@ -322,13 +107,37 @@ int main(int argc, char *argv[])
     else
     {
         printf("Usage: %s <png_file_in> <png_file_out>\n", argv[0]);
+        printf("       %s --threads <n> <png_file_in>...\n", argv[0]);
+        printf("       %s --batch <workers|0> <png_file_in|dir|@list>...\n", argv[0]);
+        printf("       %s --distill <out_dir> <png_file_in|dir|@list>...\n", argv[0]);
         return 1;
     }
 
     printf("Processing %s -> %s\n", input, output);
 
-    process_image(input, output);
+    struct input image;
+    if (input_map(input, &image))
+        return 1;
+
+    harness_init();
+
+    // Output only reaches the filesystem when a real output file is given
+    struct decode_ctx ctx;
+    if (!strcmp(output, "/dev/null"))
+        decode_ctx_init(&ctx, sink_mode_from_env(SINK_DISCARD), NULL);
+    else
+        decode_ctx_init(&ctx, sink_mode_from_env(SINK_MEMORY), output);
+
+    process_image(&ctx, image.data, image.size);
+    printf("Arena peak: %zu bytes in %zu allocations\n", ctx.arena.peak, ctx.arena.allocations);
+
+    decode_ctx_reset(&ctx);
+    governor_report();
+    watchdog_report();
 
+    decode_ctx_free(&ctx);
+    band_free();
+    input_unmap(&image);
     return 0;
 }
 
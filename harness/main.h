@@ -1,4 +1,30 @@
 #pragma once
 
-int pngtopng_main(int argc, const char **argv);
-void example1_main(char *file_name);
\ No newline at end of file
+#include <stdio.h>
+#include <stddef.h>
+#include <png.h>
+
+#include "sink.h"
+
+#define fail(msg, label)                                                                  \
+    {                                                                                     \
+        printf("FAIL on %s:%llu: %s\n", (__func__), (unsigned long long)(__LINE__), msg); \
+        goto fail_##label;                                                                \
+    }
+
+struct arena;
+struct decode_ctx;
+struct selector;
+
+int pngtopng_main(const png_byte *data, size_t size, struct arena *arena, struct sink *sink,
+                  const struct selector *selector);
+int example1_main(const png_byte *data, size_t size, struct arena *arena, const struct selector *selector);
+int progressive_main(const png_byte *data, size_t size, struct arena *arena, const struct selector *selector);
+
+void harness_init(void);
+enum sink_mode sink_mode_from_env(enum sink_mode mode);
+void process_image(struct decode_ctx *ctx, const png_byte *data, size_t size);
+
+int replay_threads(unsigned threads, int count, char **files);
+int replay_batch(unsigned workers, int count, char **args);
+int distill(const char *out_dir, int count, char **args);
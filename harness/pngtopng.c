@@ -20,76 +20,111 @@
  * ensure the code picks up the local libpng implementation:
  */
 #include "../../png.h"
+#include "arena.h"
+#include "governor.h"
+#include "selector.h"
+#include "sink.h"
 #if defined(PNG_SIMPLIFIED_READ_SUPPORTED) && \
     defined(PNG_SIMPLIFIED_WRITE_SUPPORTED)
 
-int pngtopng_main(int argc, const char **argv)
+int pngtopng_main(const png_byte *data, size_t size, struct arena *arena,
+   struct sink *sink, const struct selector *selector)
 {
    int result = 1;
+   png_image image;
 
-   if (argc == 3)
+   /* Only the image structure version number needs to be set. */
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   /* The input is already in memory, shared with the other pipelines.  The
+    * simplified API hides its png_struct, so only the pixel budget applies.
+    */
+   if (png_image_begin_read_from_memory(&image, data, size) &&
+       !governor_check_pixels(image.width, image.height))
    {
-      png_image image;
+      png_bytep buffer, colormap = NULL;
+      png_color background;
+      png_int_32 row_stride;
 
-      /* Only the image structure version number needs to be set. */
-      memset(&image, 0, sizeof image);
-      image.version = PNG_IMAGE_VERSION;
+      /* The selector picks the format.  If it is a colormap format then a
+       * colormap must also be supplied below.
+       */
+      image.format = selector->format;
 
-      if (png_image_begin_read_from_file(&image, argv[1]))
-      {
-         png_bytep buffer;
+      /* A negative stride stores the rows bottom-up. */
+      row_stride = selector->bottom_up ?
+         -(png_int_32)PNG_IMAGE_ROW_STRIDE(image) : 0;
 
-         /* Change this to try different formats!  If you set a colormap format
-          * then you must also supply a colormap below.
-          */
-         image.format = PNG_FORMAT_RGBA;
+      background.red = background.green = background.blue = selector->level;
 
-         buffer = malloc(PNG_IMAGE_SIZE(image));
+      /* The simplified API allocates libpng's own state with malloc, but the
+       * image buffer can come from the arena.
+       */
+      buffer = arena_alloc(arena, PNG_IMAGE_SIZE(image));
 
-         if (buffer != NULL)
+      if (buffer != NULL && (image.format & PNG_FORMAT_FLAG_COLORMAP) != 0)
+         colormap = arena_alloc(arena, PNG_IMAGE_COLORMAP_SIZE(image));
+
+      if (buffer != NULL &&
+          (colormap != NULL || (image.format & PNG_FORMAT_FLAG_COLORMAP) == 0))
+      {
+         if (png_image_finish_read(&image,
+            selector->background ? &background : NULL, buffer, row_stride,
+            colormap))
          {
-            if (png_image_finish_read(&image, NULL/*background*/, buffer,
-               0/*row_stride*/, NULL/*colormap for PNG_FORMAT_FLAG_COLORMAP */))
+            /* Encode straight into the sink's reusable buffer, sized for the
+             * worst case so that a single pass is always enough.
+             */
+            png_alloc_size_t length = PNG_IMAGE_PNG_SIZE_MAX(image);
+            png_bytep output;
+
+            sink_begin(sink);
+            output = sink_reserve(sink, length);
+
+            if (output != NULL && png_image_write_to_memory(&image, output,
+               &length, selector->convert_to_8bit, buffer, row_stride,
+               colormap))
             {
-               if (png_image_write_to_file(&image, argv[2],
-                  0/*convert_to_8bit*/, buffer, 0/*row_stride*/,
-                  NULL/*colormap*/))
-                  result = 0;
-
-               else
-                  fprintf(stderr, "pngtopng: write %s: %s\n", argv[2],
-                      image.message);
+               sink_commit(sink, length);
+               sink_end(sink, "pngtopng");
+               result = 0;
             }
 
             else
-               fprintf(stderr, "pngtopng: read %s: %s\n", argv[1],
-                   image.message);
-
-            free(buffer);
+               fprintf(stderr, "pngtopng: write: %s\n",
+                   output != NULL ? image.message : "out of memory");
          }
 
          else
-         {
-            fprintf(stderr, "pngtopng: out of memory: %lu bytes\n",
-               (unsigned long)PNG_IMAGE_SIZE(image));
+            fprintf(stderr, "pngtopng: read: %s\n", image.message);
 
-            /* This is the only place where a 'free' is required; libpng does
-             * the cleanup on error and success, but in this case we couldn't
-             * complete the read because of running out of memory and so libpng
-             * has not got to the point where it can do cleanup.
-             */
-            png_image_free(&image);
-         }
+         arena_free(arena, colormap);
+         arena_free(arena, buffer);
       }
 
       else
-         /* Failed to read the first argument: */
-         fprintf(stderr, "pngtopng: %s: %s\n", argv[1], image.message);
+      {
+         fprintf(stderr, "pngtopng: out of memory: %lu bytes\n",
+            (unsigned long)PNG_IMAGE_SIZE(image));
+
+         /* This is the only place where a 'free' is required; libpng does
+          * the cleanup on error and success, but in this case we couldn't
+          * complete the read because of running out of memory and so libpng
+          * has not got to the point where it can do cleanup.
+          */
+         arena_free(arena, buffer);
+         png_image_free(&image);
+      }
    }
 
    else
-      /* Wrong number of arguments */
-      fprintf(stderr, "pngtopng: usage: pngtopng input-file output-file\n");
+   {
+      /* Failed to read the input, or it was over budget: */
+      fprintf(stderr, "pngtopng: %s\n",
+          image.message[0] ? image.message : "image over the pixel budget");
+      png_image_free(&image);
+   }
 
    return result;
 }
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+
+#include "pool.h"
+
+static void pool_work(struct pool *pool)
+{
+    size_t begin;
+
+    while ((begin = __atomic_fetch_add(&pool->next, pool->band, __ATOMIC_RELAXED)) < pool->items)
+    {
+        size_t end = begin + pool->band;
+        if (end > pool->items)
+            end = pool->items;
+
+        pool->fn(pool->arg, begin, end);
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    struct pool *pool = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (!pool->stop && pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        if (pool->stop)
+            break;
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// `threads` counts the caller, so a pool of 1 runs everything inline
+struct pool *pool_create(unsigned threads)
+{
+    struct pool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->submit, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (threads > 1)
+    {
+        pool->threads = calloc(threads - 1, sizeof(pthread_t));
+        if (!pool->threads)
+        {
+            pool_destroy(pool);
+            return NULL;
+        }
+
+        for (; pool->workers < threads - 1; pool->workers++)
+            if (pthread_create(&pool->threads[pool->workers], NULL, pool_worker, pool))
+                break;
+    }
+
+    return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < pool->workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit);
+    free(pool->threads);
+    free(pool);
+}
+
+void pool_run(struct pool *pool, pool_fn fn, void *arg, size_t items, size_t band)
+{
+    if (band == 0)
+        band = 1;
+
+    if (pool->workers == 0 || items <= band)
+    {
+        fn(arg, 0, items);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->submit);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->items = items;
+    pool->band = band;
+    pool->next = 0;
+    pool->active = pool->workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->submit);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Persistent worker pool that splits a range of items into bands. The
+// submitting thread works on bands too, and only one job runs at a time.
+typedef void (*pool_fn)(void *arg, size_t begin, size_t end);
+
+struct pool
+{
+    pthread_t *threads;
+    unsigned workers; // Threads besides the caller
+
+    pthread_mutex_t submit; // Serializes pool_run() callers
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned long generation;
+    unsigned active;
+    int stop;
+
+    // The current job
+    pool_fn fn;
+    void *arg;
+    size_t items;
+    size_t band;
+    size_t next;
+};
+
+struct pool *pool_create(unsigned threads);
+void pool_destroy(struct pool *pool);
+void pool_run(struct pool *pool, pool_fn fn, void *arg, size_t items, size_t band);
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <png.h>
+
+#include "main.h"
+#include "arena.h"
+#include "decode.h"
+#include "governor.h"
+#include "kernel.h"
+#include "selector.h"
+#include "slow.h"
+#include "telemetry.h"
+#include "watchdog.h"
+
+// Everything allocated here lives in the context's arena, the caller resets
+// it after. Each pipeline gives its allocations back when it is done, so the
+// governor's alloc limit applies to them one at a time. Pixels live in the
+// slab, which is kept across inputs. An input with a selector (see
+// selector.h) only runs the pipeline it picks.
+void process_image(struct decode_ctx *ctx, const png_byte *data, size_t size)
+{
+    struct selector selector;
+    struct telemetry_mark mark;
+    struct arena_mark stage;
+    struct slow_mark slow;
+    size_t image_size = selector_parse(&selector, data, size);
+
+    slow_begin(&slow);
+    telemetry_input();
+
+    // Perform the processing of the pngtopng code
+    if (selector.pipeline == SELECT_ALL || selector.pipeline == SELECT_PNGTOPNG)
+    {
+        watchdog_begin(WATCHDOG_PNGTOPNG);
+        arena_mark(&ctx->arena, &stage);
+        telemetry_begin(&mark, &ctx->arena);
+        pngtopng_main(data, image_size, &ctx->arena, &ctx->sink, selector.pipeline ? &selector : &selector_pngtopng);
+        telemetry_end(TELEMETRY_PNGTOPNG, &mark, &ctx->arena);
+        arena_release(&ctx->arena, &stage);
+        watchdog_end();
+    }
+
+    // Perform the processing of the example1 code
+    if (selector.pipeline == SELECT_ALL || selector.pipeline == SELECT_EXAMPLE1)
+    {
+        watchdog_begin(WATCHDOG_EXAMPLE1);
+        arena_mark(&ctx->arena, &stage);
+        telemetry_begin(&mark, &ctx->arena);
+        example1_main(data, image_size, &ctx->arena, selector.pipeline ? &selector : &selector_example1);
+        telemetry_end(TELEMETRY_EXAMPLE1, &mark, &ctx->arena);
+        arena_release(&ctx->arena, &stage);
+        watchdog_end();
+    }
+
+    // Peform our processing
+    if (selector.pipeline == SELECT_ALL || selector.pipeline == SELECT_DECODE)
+    {
+        const struct selector *config = selector.pipeline ? &selector : &selector_decode;
+        watchdog_begin(WATCHDOG_DECODE);
+        arena_mark(&ctx->arena, &stage);
+
+        // Buffered passes, unless asked to go row by row
+        if (decode_stream || selector.stream)
+        {
+            telemetry_begin(&mark, &ctx->arena);
+            stream_png_file(ctx, data, image_size, config);
+            telemetry_end(TELEMETRY_STREAM, &mark, &ctx->arena);
+        }
+        else
+        {
+            telemetry_begin(&mark, &ctx->arena);
+            read_png_file(ctx, data, image_size, config);
+            telemetry_end(TELEMETRY_READ, &mark, &ctx->arena);
+
+            telemetry_begin(&mark, &ctx->arena);
+            process_png_file(ctx);
+            telemetry_end(TELEMETRY_PROCESS, &mark, &ctx->arena);
+
+            telemetry_begin(&mark, &ctx->arena);
+            write_png_file(ctx);
+            telemetry_end(TELEMETRY_WRITE, &mark, &ctx->arena);
+        }
+        arena_release(&ctx->arena, &stage);
+        watchdog_end();
+    }
+
+    // Push the input through the progressive reader, in pieces
+    if (selector.pipeline == SELECT_ALL || selector.pipeline == SELECT_PROGRESSIVE)
+    {
+        watchdog_begin(WATCHDOG_PROGRESSIVE);
+        arena_mark(&ctx->arena, &stage);
+        telemetry_begin(&mark, &ctx->arena);
+        progressive_main(data, image_size, &ctx->arena, selector.pipeline ? &selector : &selector_progressive);
+        telemetry_end(TELEMETRY_PROGRESSIVE, &mark, &ctx->arena);
+        arena_release(&ctx->arena, &stage);
+        watchdog_end();
+    }
+
+    // The whole input is saved, selector included
+    slow_end(&slow, data, size, ctx->arena.peak + ctx->slab.size);
+}
+
+// One-time setup shared by every context, before any thread is started
+void harness_init(void)
+{
+    governor_init();
+    watchdog_init();
+    telemetry_init();
+    slow_init();
+    kernel_init();
+    band_init();
+}
+
+// HARNESS_SINK=discard|hash|memory overrides the default output sink
+enum sink_mode sink_mode_from_env(enum sink_mode mode)
+{
+    const char *name = getenv("HARNESS_SINK");
+
+    if (name && sink_parse_mode(name, &mode))
+        printf("Unknown HARNESS_SINK=%s, ignoring it\n", name);
+
+    return mode;
+}
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "profile.h"
+
+#ifdef HARNESS_PROFILE
+
+// From the clang profile runtime
+void __llvm_profile_reset_counters(void);
+void __llvm_profile_set_filename(const char *name);
+int __llvm_profile_write_file(void);
+char *__llvm_profile_begin_counters(void);
+char *__llvm_profile_end_counters(void);
+
+static void profile_path(const char *file, char *path, size_t size)
+{
+    const char *dir = getenv("HARNESS_PROFILE_DIR");
+    const char *name = strrchr(file, '/');
+    size_t length = 0;
+
+    name = name ? name + 1 : file;
+
+    // <sha>_<n>.png in corpus/, <hash>.<...>.honggfuzz.cov from the fuzzer
+    while (isxdigit((unsigned char)name[length]))
+        length++;
+    if (length < 16)
+        length = strlen(name);
+
+    snprintf(path, size, "%s/%.*s.profraw", dir ? dir : ".", (int)length, name);
+}
+
+int profile_cached(const char *file)
+{
+    char path[4096];
+
+    profile_path(file, path, sizeof(path));
+    return !access(path, F_OK);
+}
+
+void profile_begin(void)
+{
+    __llvm_profile_reset_counters();
+}
+
+void profile_end(const char *file)
+{
+    char path[4096];
+
+    profile_path(file, path, sizeof(path));
+    __llvm_profile_set_filename(path);
+    if (__llvm_profile_write_file())
+        printf("FAIL on %s: __llvm_profile_write_file(%s)\n", __func__, path);
+
+    // Keep the dump at exit from landing on top of this input's profile
+    __llvm_profile_set_filename("/dev/null");
+}
+
+size_t profile_counters(const uint64_t **counters)
+{
+    char *begin = __llvm_profile_begin_counters();
+
+    *counters = (const uint64_t *)begin;
+    return (__llvm_profile_end_counters() - begin) / sizeof(uint64_t);
+}
+
+#else
+
+int profile_cached(const char *file)
+{
+    (void)file;
+    return 0;
+}
+
+void profile_begin(void)
+{
+}
+
+void profile_end(const char *file)
+{
+    (void)file;
+}
+
+size_t profile_counters(const uint64_t **counters)
+{
+    *counters = NULL;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-input source-based coverage profiles, written by -DHARNESS_PROFILE builds
+// to $HARNESS_PROFILE_DIR/<key>.profraw. The key is the SHA the corpus file names
+// start with, so an input that already has a profile is not replayed again.
+// Everything is a no-op in other builds.
+int profile_cached(const char *file);
+void profile_begin(void);
+void profile_end(const char *file);
+
+// Live counters of the whole binary (harness and libpng), 0 outside profiling builds
+size_t profile_counters(const uint64_t **counters);
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <png.h>
+
+#include "main.h"
+#include "arena.h"
+#include "decode.h"
+#include "governor.h"
+#include "kernel.h"
+#include "selector.h"
+#include "watchdog.h"
+
+// Push decoding, the way a client decodes a PNG streamed over the network:
+// the input is handed to png_process_data() in pieces, and every row is
+// processed as soon as libpng emits it. Only one row is kept, unless the
+// selector turns on interlace handling, where later passes are combined
+// into the rows of earlier ones and the whole image has to stay around.
+struct progressive
+{
+    png_uint_32 width, height;
+    int interlaced;
+    int combine;
+
+    png_bytep row;   // The row being processed
+    png_bytep image; // Every row, only when combining passes
+    size_t rowbytes;
+
+    const struct selector *selector;
+    int done;
+};
+
+static void progressive_info(png_structp png, png_infop info)
+{
+    struct progressive *state = png_get_progressive_ptr(png);
+
+    state->width = png_get_image_width(png, info);
+    state->height = png_get_image_height(png, info);
+
+    if (governor_check_pixels(state->width, state->height))
+        png_error(png, "image over the pixel budget");
+
+    decode_set_rgba(png, info, state->selector);
+
+    // Transforms must be set before png_read_update_info(), rows may arrive right after
+    state->interlaced = png_get_interlace_type(png, info) != PNG_INTERLACE_NONE;
+    state->combine = state->interlaced && (state->selector->transforms & SELECT_INTERLACE);
+    if (state->combine)
+        png_set_interlace_handling(png);
+
+    png_read_update_info(png, info);
+
+    // The threshold kernel walks 8bit RGBA pixels
+    state->rowbytes = png_get_rowbytes(png, info);
+    if (state->rowbytes < (size_t)state->width * 4)
+        png_error(png, "png_get_rowbytes() is not 8bit RGBA");
+
+    // png_malloc() goes to the arena, and reports running out through png_error()
+    if (state->combine)
+    {
+        state->image = png_malloc(png, state->rowbytes * state->height);
+        memset(state->image, 0, state->rowbytes * state->height);
+    }
+    else
+    {
+        state->row = png_malloc(png, state->rowbytes);
+    }
+}
+
+static void progressive_row(png_structp png, png_bytep new_row, png_uint_32 row_num, int pass)
+{
+    struct progressive *state = png_get_progressive_ptr(png);
+
+    if (row_num >= state->height)
+        png_error(png, "row out of range");
+
+    watchdog_check(png);
+
+    // Interlaced rows are only complete once every pass went through, see progressive_end()
+    if (state->combine)
+    {
+        png_progressive_combine_row(png, state->image + row_num * state->rowbytes, new_row);
+        return;
+    }
+
+    if (!new_row)
+        return;
+
+    // Without interlace handling, the rows of a pass are the pass's reduced width
+    png_uint_32 pixels = state->width;
+    if (state->interlaced)
+        pixels = PNG_PASS_COLS(state->width, pass);
+
+    memcpy(state->row, new_row, (size_t)pixels * 4);
+    threshold_kernel.fn(state->row, pixels);
+}
+
+static void progressive_end(png_structp png, png_infop info)
+{
+    struct progressive *state = png_get_progressive_ptr(png);
+
+    if (state->combine)
+        for (png_uint_32 y = 0; y < state->height; y++)
+            threshold_kernel.fn(state->image + y * state->rowbytes, state->width);
+
+    state->done = 1;
+}
+
+// Size of the next piece handed to png_process_data()
+static size_t progressive_piece(png_uint_32 *rng)
+{
+    if (!*rng)
+        return 4096;
+
+    // xorshift32, pieces from 1 byte to 8K, small ones most often
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+
+    return 1 + ((*rng >> 8) & ((1u << (*rng % 14)) - 1));
+}
+
+int progressive_main(const png_byte *data, size_t size, struct arena *arena, const struct selector *selector)
+{
+    struct progressive state = {.selector = selector};
+    png_uint_32 rng = selector->schedule ? selector->schedule * 0x9e3779b9u : 0;
+    size_t offset = 0;
+    int result = 1;
+
+    png_structp png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, governor_error_fn, governor_warning_fn,
+                                               arena, arena_png_malloc, arena_png_free);
+    if (!png)
+        fail("png_create_read_struct_2()", none);
+
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+        fail("png_create_info_struct()", read_struct);
+
+    if (setjmp(png_jmpbuf(png)))
+        fail("setjmp(png_jmpbuf())", info_struct);
+
+    png_set_progressive_read_fn(png, &state, progressive_info, progressive_row, progressive_end);
+    governor_apply(png);
+    decode_set_gamma(png, selector);
+
+    // Give chunks of data as they arrive from the data stream (in order, of course)
+    while (offset < size && !state.done)
+    {
+        size_t length = progressive_piece(&rng);
+        if (length > size - offset)
+            length = size - offset;
+
+        watchdog_check(png);
+        png_process_data(png, info, (png_bytep)data + offset, length);
+        offset += length;
+    }
+
+    // A truncated stream is not an error to a network client, it just never ends
+    result = !state.done;
+
+fail_info_struct:
+    png_destroy_read_struct(&png, &info, NULL);
+    goto fail_none;
+
+fail_read_struct:
+    png_destroy_read_struct(&png, NULL, NULL);
+
+fail_none:
+    return result;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "main.h"
+#include "decode.h"
+#include "governor.h"
+#include "watchdog.h"
+#include "input.h"
+
+// Decodes many inputs concurrently in one process, one context per thread
+struct replay
+{
+    char **files;
+    int count;
+    int next;
+
+    unsigned long long processed;
+    unsigned long long unreadable;
+};
+
+static void *replay_worker(void *arg)
+{
+    struct replay *replay = arg;
+    struct decode_ctx ctx;
+    int i;
+
+    decode_ctx_init(&ctx, sink_mode_from_env(SINK_DISCARD), NULL);
+
+    while ((i = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED)) < replay->count)
+    {
+        struct input image;
+        if (input_map(replay->files[i], &image))
+        {
+            __atomic_fetch_add(&replay->unreadable, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        process_image(&ctx, image.data, image.size);
+        decode_ctx_reset(&ctx);
+        input_unmap(&image);
+
+        __atomic_fetch_add(&replay->processed, 1, __ATOMIC_RELAXED);
+    }
+
+    decode_ctx_free(&ctx);
+    return NULL;
+}
+
+int replay_threads(unsigned threads, int count, char **files)
+{
+    struct replay replay = {files, count, 0, 0, 0};
+    struct timespec start, end;
+
+    if (threads < 1)
+        threads = 1;
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    if (!workers)
+        fail("calloc()", none);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned started = 0;
+    for (; started < threads; started++)
+        if (pthread_create(&workers[started], NULL, replay_worker, &replay))
+            break;
+
+    if (!started)
+        fail("pthread_create()", workers);
+
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Replayed %llu inputs (%llu unreadable) on %u threads in %.3fs\n",
+           replay.processed, replay.unreadable, started,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    governor_report();
+    watchdog_report();
+
+    free(workers);
+    return replay.unreadable != 0;
+
+fail_workers:
+    free(workers);
+
+fail_none:
+    return 1;
+}
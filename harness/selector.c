@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "selector.h"
+
+// Gamma values a selector can pick, the libpng specials first
+static const double selector_gammas[16] = {
+    PNG_DEFAULT_sRGB, PNG_GAMMA_MAC_18, 1.0, 0.45455, 2.2, 1.8, 0.55556, 2.5,
+    0.4, 1.5, 0.66667, 3.0, 0.33333, 0.1, 10.0, 0.01,
+};
+
+// The 12 bytes of an empty IEND chunk, CRC included
+static const png_byte selector_iend[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82};
+
+const struct selector selector_pngtopng = {
+    .pipeline = SELECT_PNGTOPNG,
+    .format = PNG_FORMAT_RGBA,
+};
+
+const struct selector selector_example1 = {
+    .pipeline = SELECT_EXAMPLE1,
+    .transforms = SELECT_SCALE_16 | SELECT_STRIP_ALPHA | SELECT_PACKING | SELECT_PACKSWAP | SELECT_PALETTE_TO_RGB |
+                  SELECT_EXPAND_GRAY | SELECT_TRNS_TO_ALPHA | SELECT_BACKGROUND | SELECT_GAMMA | SELECT_QUANTIZE |
+                  SELECT_INVERT_MONO | SELECT_SHIFT | SELECT_BGR | SELECT_SWAP_ALPHA | SELECT_SWAP | SELECT_FILLER |
+                  SELECT_INTERLACE,
+    .screen_gamma = PNG_DEFAULT_sRGB,
+    .file_gamma = 0.45455,
+};
+
+const struct selector selector_decode = {
+    .pipeline = SELECT_DECODE,
+    .transforms = SELECT_ALPHA_MODE | SELECT_GAMMA,
+    .screen_gamma = 1,
+    .file_gamma = PNG_GAMMA_MAC_18,
+    .alpha_gamma = PNG_DEFAULT_sRGB,
+    .alpha_mode = PNG_ALPHA_OPTIMIZED,
+};
+
+const struct selector selector_progressive = {
+    .pipeline = SELECT_PROGRESSIVE,
+    .transforms = SELECT_ALPHA_MODE | SELECT_GAMMA,
+    .screen_gamma = 1,
+    .file_gamma = PNG_GAMMA_MAC_18,
+    .alpha_gamma = PNG_DEFAULT_sRGB,
+    .alpha_mode = PNG_ALPHA_OPTIMIZED,
+};
+
+size_t selector_parse(struct selector *selector, const png_byte *data, size_t size)
+{
+    memset(selector, 0, sizeof(*selector));
+
+    // Seeds and anything well-formed keep running every pipeline
+    if (size < 8 + SELECTOR_SIZE || !memcmp(data + size - sizeof(selector_iend), selector_iend, sizeof(selector_iend)))
+    {
+        selector->pipeline = SELECT_ALL;
+        return size;
+    }
+
+    const png_byte *p = data + size - SELECTOR_SIZE;
+
+    selector->pipeline = SELECT_PNGTOPNG + (p[0] & 3);
+    selector->schedule = p[0] >> 2;
+    selector->transforms = p[1] | p[2] << 8 | p[3] << 16;
+
+    selector->screen_gamma = selector_gammas[p[4] & 15];
+    selector->file_gamma = selector_gammas[p[4] >> 4];
+    selector->alpha_gamma = selector_gammas[p[5] & 15];
+    selector->alpha_mode = p[5] >> 4 & 3;
+    selector->background = p[5] >> 6 & 1;
+    selector->stream = p[5] >> 7;
+
+    selector->format = p[6] & 0x3f;
+    selector->convert_to_8bit = p[6] >> 6 & 1;
+    selector->bottom_up = p[6] >> 7;
+
+    selector->level = p[7];
+    return size - SELECTOR_SIZE;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+// Which pipeline an input runs through, and how it is configured. Inputs that
+// end with an IEND chunk run every pipeline with its fixed configuration.
+// Anything else ends with an 8 byte selector, stripped before decoding:
+//
+//   0     pipeline (low 2 bits: pngtopng, example1, decode, progressive),
+//         progressive feeding schedule (bits 2-7)
+//   1..3  transforms, little endian SELECT_* bits
+//   4     screen gamma (low nibble) and file gamma (high nibble), see selector.c
+//   5     alpha mode gamma (low nibble), alpha mode (bits 4-5), background (bit 6),
+//         stream_png_file() rather than the buffered passes (bit 7)
+//   6     PNG_FORMAT_* for the simplified API (bits 0-5), convert_to_8bit (bit 6),
+//         bottom-up row stride (bit 7)
+//   7     background gray level
+#define SELECTOR_SIZE 8
+
+enum selector_pipeline
+{
+    SELECT_ALL,
+    SELECT_PNGTOPNG,
+    SELECT_EXAMPLE1,
+    SELECT_DECODE,
+    SELECT_PROGRESSIVE,
+};
+
+// png_set_* transforms. example1 honours all of them, read_png_file and the
+// progressive reader only the ones that keep their output 8bit RGBA.
+enum selector_transform
+{
+    SELECT_SCALE_16 = 1 << 0,
+    SELECT_STRIP_16 = 1 << 1,
+    SELECT_STRIP_ALPHA = 1 << 2,
+    SELECT_PACKING = 1 << 3,
+    SELECT_PACKSWAP = 1 << 4,
+    SELECT_PALETTE_TO_RGB = 1 << 5,
+    SELECT_EXPAND_GRAY = 1 << 6,
+    SELECT_TRNS_TO_ALPHA = 1 << 7,
+    SELECT_BACKGROUND = 1 << 8,
+    SELECT_GAMMA = 1 << 9,
+    SELECT_QUANTIZE = 1 << 10,
+    SELECT_INVERT_MONO = 1 << 11,
+    SELECT_SHIFT = 1 << 12,
+    SELECT_BGR = 1 << 13,
+    SELECT_SWAP_ALPHA = 1 << 14,
+    SELECT_SWAP = 1 << 15,
+    SELECT_FILLER = 1 << 16,
+    SELECT_INTERLACE = 1 << 17,
+    SELECT_GRAY_TO_RGB = 1 << 18,
+    SELECT_EXPAND = 1 << 19,
+    SELECT_INVERT_ALPHA = 1 << 20,
+    SELECT_RGB_TO_GRAY = 1 << 21,
+    SELECT_ALPHA_MODE = 1 << 22,
+    SELECT_EXPAND_16 = 1 << 23,
+};
+
+struct selector
+{
+    enum selector_pipeline pipeline;
+    unsigned transforms;
+
+    double screen_gamma;
+    double file_gamma; // Used when the file has neither sRGB nor gAMA
+    double alpha_gamma;
+    int alpha_mode; // PNG_ALPHA_*
+
+    png_uint_32 format; // PNG_FORMAT_*
+    int convert_to_8bit;
+    int bottom_up;
+
+    int background; // Composite the simplified API read over background
+    png_byte level; // Gray level of the background, in every pipeline
+
+    unsigned schedule; // Seeds the sizes fed to png_process_data(), 0 for fixed 4K pieces
+    int stream;        // The decode pipeline streams rows
+};
+
+// The fixed configuration of each pipeline, used when there is no selector
+extern const struct selector selector_pngtopng;
+extern const struct selector selector_example1;
+extern const struct selector selector_decode;
+extern const struct selector selector_progressive;
+
+// Returns the size of the image without its selector
+size_t selector_parse(struct selector *selector, const png_byte *data, size_t size);
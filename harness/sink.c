@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "sink.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+void sink_init(struct sink *sink, enum sink_mode mode, const char *filename)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->mode = mode;
+    sink->filename = filename;
+    sink->hash = FNV_OFFSET_BASIS;
+}
+
+void sink_free(struct sink *sink)
+{
+    free(sink->data);
+    sink->data = NULL;
+    sink->capacity = 0;
+    sink->length = 0;
+}
+
+int sink_parse_mode(const char *name, enum sink_mode *mode)
+{
+    if (!strcmp(name, "discard"))
+        *mode = SINK_DISCARD;
+    else if (!strcmp(name, "hash"))
+        *mode = SINK_HASH;
+    else if (!strcmp(name, "memory"))
+        *mode = SINK_MEMORY;
+    else
+        return 1;
+
+    return 0;
+}
+
+void sink_begin(struct sink *sink)
+{
+    sink->length = 0;
+    sink->hash = FNV_OFFSET_BASIS;
+}
+
+void sink_end(struct sink *sink, const char *label)
+{
+    if (sink->mode == SINK_HASH)
+        printf("sink: %s %zu %016llx\n", label, sink->length, (unsigned long long)sink->hash);
+
+    if (sink->mode != SINK_MEMORY || !sink->filename)
+        return;
+
+    FILE *fp = fopen(sink->filename, "wb");
+    if (!fp)
+        fail("fopen()", none);
+
+    if (fwrite(sink->data, 1, sink->length, fp) != sink->length)
+        fail("fwrite()", fp);
+
+fail_fp:
+    fclose(fp);
+
+fail_none:
+    return;
+}
+
+static void sink_hash(struct sink *sink, png_const_bytep data, size_t length)
+{
+    uint64_t hash = sink->hash;
+
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * FNV_PRIME;
+
+    sink->hash = hash;
+}
+
+// Returns room for at least `length` more bytes after the current output
+png_bytep sink_reserve(struct sink *sink, size_t length)
+{
+    // Only memory mode keeps earlier output, the others reuse the buffer
+    size_t offset = sink->mode == SINK_MEMORY ? sink->length : 0;
+
+    if (length > sink->capacity - offset)
+    {
+        size_t capacity = sink->capacity ? sink->capacity : 4096;
+        while (capacity - offset < length)
+            capacity *= 2;
+
+        png_bytep data = realloc(sink->data, capacity);
+        if (!data)
+            return NULL;
+
+        sink->data = data;
+        sink->capacity = capacity;
+    }
+
+    return sink->data + offset;
+}
+
+// Accounts for `length` bytes that were placed at sink_reserve()
+void sink_commit(struct sink *sink, size_t length)
+{
+    if (sink->mode == SINK_HASH)
+        sink_hash(sink, sink->data, length);
+
+    sink->length += length;
+}
+
+int sink_write(struct sink *sink, png_const_bytep data, size_t length)
+{
+    if (sink->mode == SINK_HASH)
+        sink_hash(sink, data, length);
+
+    if (sink->mode == SINK_MEMORY)
+    {
+        png_bytep out = sink_reserve(sink, length);
+        if (!out)
+            fail("sink_reserve()", none);
+
+        memcpy(out, data, length);
+    }
+
+    sink->length += length;
+    return 0;
+
+fail_none:
+    return 1;
+}
+
+void sink_write_fn(png_structp png_ptr, png_bytep data, size_t length)
+{
+    struct sink *sink = (struct sink *)png_get_io_ptr(png_ptr);
+
+    if (sink_write(sink, data, length))
+        png_error(png_ptr, "Write Error");
+}
+
+void sink_flush_fn(png_structp png_ptr)
+{
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <png.h>
+
+// Where encoded PNG output goes. The encoders always run in full, but no
+// syscalls are issued per output block in any of the modes.
+enum sink_mode
+{
+    SINK_DISCARD, // Only count the bytes
+    SINK_HASH,    // Count and hash the bytes (FNV-1a), printed per output
+    SINK_MEMORY,  // Keep the bytes in a reusable buffer, optionally saved to a file
+};
+
+struct sink
+{
+    enum sink_mode mode;
+    const char *filename; // Saved on sink_end() in memory mode, may be NULL
+
+    png_bytep data; // Grown to a high-water mark and reused across outputs
+    size_t capacity;
+
+    size_t length; // Bytes in the current output
+    uint64_t hash;
+};
+
+void sink_init(struct sink *sink, enum sink_mode mode, const char *filename);
+void sink_free(struct sink *sink);
+int sink_parse_mode(const char *name, enum sink_mode *mode);
+
+void sink_begin(struct sink *sink);
+void sink_end(struct sink *sink, const char *label);
+
+png_bytep sink_reserve(struct sink *sink, size_t length);
+void sink_commit(struct sink *sink, size_t length);
+int sink_write(struct sink *sink, png_const_bytep data, size_t length);
+
+// libpng callbacks for png_set_write_fn(), the io_ptr is the sink
+void sink_write_fn(png_structp png_ptr, png_bytep data, size_t length);
+void sink_flush_fn(png_structp png_ptr);
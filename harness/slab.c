@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "asan.h"
+#include "slab.h"
+
+void slab_init(struct slab *slab)
+{
+    slab->data = NULL;
+    slab->capacity = 0;
+    slab->size = 0;
+}
+
+void slab_free(struct slab *slab)
+{
+    if (slab->data)
+    {
+        HARNESS_UNPOISON(slab->data, slab->capacity);
+        free(slab->data);
+    }
+
+    slab_init(slab);
+}
+
+// Lays out `height` rows of `rowbytes` back to back in the slab and points
+// row_pointers at them. Bytes past the image are poisoned under ASan.
+png_bytep slab_rows(struct slab *slab, png_bytepp row_pointers, png_uint_32 height, size_t rowbytes)
+{
+    if (rowbytes && height > SIZE_MAX / rowbytes)
+        return NULL;
+
+    size_t size = (size_t)height * rowbytes;
+
+    if (size > slab->capacity)
+    {
+        size_t capacity = slab->capacity * 2;
+        if (capacity < size)
+            capacity = size;
+        capacity = (capacity + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+
+        void *data;
+        if (posix_memalign(&data, SLAB_ALIGN, capacity))
+            return NULL;
+
+        slab_free(slab);
+        slab->data = data;
+        slab->capacity = capacity;
+    }
+
+    HARNESS_UNPOISON(slab->data, size);
+    HARNESS_POISON(slab->data + size, slab->capacity - size);
+    slab->size = size;
+
+    for (png_uint_32 y = 0; y < height; y++)
+        row_pointers[y] = slab->data + y * rowbytes;
+
+    return slab->data;
+}
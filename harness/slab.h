@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+#define SLAB_ALIGN 64
+
+// A single contiguous, SLAB_ALIGN-aligned pixel buffer for a whole image.
+// It is kept across inputs and only grows, up to the largest image seen.
+struct slab
+{
+    png_bytep data;
+    size_t capacity;
+    size_t size; // Bytes used by the current image
+};
+
+void slab_init(struct slab *slab);
+void slab_free(struct slab *slab);
+
+png_bytep slab_rows(struct slab *slab, png_bytepp row_pointers, png_uint_32 height, size_t rowbytes);
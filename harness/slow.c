@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "slow.h"
+
+const char *slow_units;
+
+// Shared with every other process using the same directory
+static unsigned long long *slow_maxima;
+
+static const char *slow_names[SLOW_METRICS] = {
+    [SLOW_NANOSECONDS] = "nanoseconds",
+    [SLOW_INSTRUCTIONS] = "instructions",
+    [SLOW_PEAK] = "peak",
+};
+
+// Per thread instruction counter, 0 until opened, -1 when perf is off limits
+static __thread int slow_perf_fd;
+static int slow_perf_warned;
+
+// One function per metric and power of two, each of them an edge of its own
+// to the fuzzer's coverage
+static volatile unsigned slow_edges;
+
+#define SLOW_EDGE(m, n) \
+    static __attribute__((noinline)) void slow_edge_##m##_##n(void) { slow_edges += 0##n; }
+#define SLOW_EDGE8(m, h) \
+    SLOW_EDGE(m, h##0) SLOW_EDGE(m, h##1) SLOW_EDGE(m, h##2) SLOW_EDGE(m, h##3) \
+    SLOW_EDGE(m, h##4) SLOW_EDGE(m, h##5) SLOW_EDGE(m, h##6) SLOW_EDGE(m, h##7)
+#define SLOW_EDGE64(m) \
+    SLOW_EDGE8(m, 0) SLOW_EDGE8(m, 1) SLOW_EDGE8(m, 2) SLOW_EDGE8(m, 3) \
+    SLOW_EDGE8(m, 4) SLOW_EDGE8(m, 5) SLOW_EDGE8(m, 6) SLOW_EDGE8(m, 7)
+
+#define SLOW_ENTRY8(m, h) \
+    slow_edge_##m##_##h##0, slow_edge_##m##_##h##1, slow_edge_##m##_##h##2, slow_edge_##m##_##h##3, \
+    slow_edge_##m##_##h##4, slow_edge_##m##_##h##5, slow_edge_##m##_##h##6, slow_edge_##m##_##h##7
+#define SLOW_ENTRY64(m) \
+    {SLOW_ENTRY8(m, 0), SLOW_ENTRY8(m, 1), SLOW_ENTRY8(m, 2), SLOW_ENTRY8(m, 3), \
+     SLOW_ENTRY8(m, 4), SLOW_ENTRY8(m, 5), SLOW_ENTRY8(m, 6), SLOW_ENTRY8(m, 7)}
+
+SLOW_EDGE64(0)
+SLOW_EDGE64(1)
+SLOW_EDGE64(2)
+
+static void (*const slow_edge[SLOW_METRICS][64])(void) = {
+    SLOW_ENTRY64(0),
+    SLOW_ENTRY64(1),
+    SLOW_ENTRY64(2),
+};
+
+static unsigned long long slow_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void slow_init(void)
+{
+    const char *dir = getenv("HARNESS_SLOW_UNITS");
+    if (!dir)
+        return;
+
+    if (mkdir(dir, 0755) && errno != EEXIST)
+    {
+        printf("FAIL on %s: mkdir(%s), not looking for slow units\n", __func__, dir);
+        return;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.maxima", dir);
+
+    size_t length = SLOW_METRICS * sizeof(unsigned long long);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || (st.st_size && st.st_size != (off_t)length) || ftruncate(fd, length))
+    {
+        printf("FAIL on %s: cannot set up %s, not looking for slow units\n", __func__, path);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    void *maxima = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (maxima == MAP_FAILED)
+    {
+        printf("FAIL on %s: mmap(%s), not looking for slow units\n", __func__, path);
+        return;
+    }
+
+    slow_maxima = maxima;
+    slow_units = dir;
+}
+
+// Retired user-space instructions of the calling thread, 0 if perf is off limits
+static unsigned long long slow_instructions(void)
+{
+    if (!slow_perf_fd)
+    {
+        struct perf_event_attr attr = {
+            .type = PERF_TYPE_HARDWARE,
+            .size = sizeof(attr),
+            .config = PERF_COUNT_HW_INSTRUCTIONS,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+        };
+
+        slow_perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (slow_perf_fd < 0)
+        {
+            slow_perf_fd = -1;
+            if (!__atomic_exchange_n(&slow_perf_warned, 1, __ATOMIC_RELAXED))
+                printf("perf_event_open() failed, slow units are measured without instruction counts\n");
+        }
+    }
+
+    unsigned long long count = 0;
+    if (slow_perf_fd < 0 || read(slow_perf_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+
+    return count;
+}
+
+void slow_begin(struct slow_mark *mark)
+{
+    if (!slow_units)
+        return;
+
+    mark->instructions = slow_instructions();
+    mark->ns = slow_now();
+}
+
+// Returns non-zero if the value is a new maximum
+static int slow_climb(enum slow_metric metric, unsigned long long value)
+{
+    if (!value)
+        return 0;
+
+    slow_edge[metric][63 - __builtin_clzll(value)]();
+
+    unsigned long long max = __atomic_load_n(&slow_maxima[metric], __ATOMIC_RELAXED);
+    while (value > max)
+        if (__atomic_compare_exchange_n(&slow_maxima[metric], &max, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 1;
+
+    return 0;
+}
+
+static void slow_save(const png_byte *data, size_t size, const unsigned long long *values, unsigned records)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a, as the hash sink
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx.png", slow_units, (unsigned long long)hash);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp || fwrite(data, 1, size, fp) != size)
+    {
+        printf("FAIL on %s: cannot write %s\n", __func__, path);
+        if (fp)
+            fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    // Next to it, e.g. "nanoseconds=1834201 instructions=0 peak=5242880 records=nanoseconds,peak"
+    snprintf(path, sizeof(path), "%s/%016llx.txt", slow_units, (unsigned long long)hash);
+    if (!(fp = fopen(path, "w")))
+        return;
+
+    for (int i = 0; i < SLOW_METRICS; i++)
+        fprintf(fp, "%s=%llu ", slow_names[i], values[i]);
+
+    const char *separator = "records=";
+    for (int i = 0; i < SLOW_METRICS; i++)
+        if (records & (1u << i))
+        {
+            fprintf(fp, "%s%s", separator, slow_names[i]);
+            separator = ",";
+        }
+    fprintf(fp, "\n");
+    fclose(fp);
+}
+
+void slow_end(const struct slow_mark *mark, const png_byte *data, size_t size, size_t peak)
+{
+    if (!slow_units)
+        return;
+
+    unsigned long long values[SLOW_METRICS] = {
+        [SLOW_NANOSECONDS] = slow_now() - mark->ns,
+        [SLOW_INSTRUCTIONS] = mark->instructions ? slow_instructions() - mark->instructions : 0,
+        [SLOW_PEAK] = peak,
+    };
+
+    unsigned records = 0;
+    for (int i = 0; i < SLOW_METRICS; i++)
+        if (slow_climb(i, values[i]))
+            records |= 1u << i;
+
+    if (records)
+        slow_save(data, size, values, records);
+}
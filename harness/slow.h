@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <png.h>
+
+// Performance-bug hunting. With HARNESS_SLOW_UNITS=<dir>, every input is
+// measured (wall time, retired instructions where perf_event_open() allows
+// it, peak memory), and one that sets a new maximum on any of them is saved
+// to <dir>/<hash>.png, its measurements next to it in <hash>.txt. The
+// maxima are kept in <dir>/.maxima, shared by every worker and campaign.
+// Each measurement also hits a code edge per power of two, so a
+// coverage-guided fuzzer keeps inputs that climb to a higher one.
+enum slow_metric
+{
+    SLOW_NANOSECONDS,
+    SLOW_INSTRUCTIONS,
+    // Arena high-water mark plus the slab's bitmap. What the simplified API
+    // allocates inside pngtopng_main() goes to malloc() and is not counted,
+    // only the image buffer it reads into
+    SLOW_PEAK,
+    SLOW_METRICS,
+};
+
+// Where an input started
+struct slow_mark
+{
+    unsigned long long ns;
+    unsigned long long instructions;
+};
+
+extern const char *slow_units; // NULL unless HARNESS_SLOW_UNITS is set
+
+void slow_init(void);
+
+// Bracket a whole input; both are no-ops unless slow_units is set
+void slow_begin(struct slow_mark *mark);
+void slow_end(const struct slow_mark *mark, const png_byte *data, size_t size, size_t peak);
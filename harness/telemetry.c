@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "arena.h"
+#include "telemetry.h"
+
+// The segment's magic while its first user calibrates the clock
+#define TELEMETRY_CALIBRATING 1u
+
+struct telemetry_segment *telemetry;
+
+static unsigned long long telemetry_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned long long telemetry_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return telemetry_now_ns();
+#endif
+}
+
+// TSC ticks per nanosecond, measured over 10ms
+static double telemetry_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec pause = {0, 10000000};
+    unsigned long long ns = telemetry_now_ns(), ticks = telemetry_ticks();
+
+    nanosleep(&pause, NULL);
+    return (double)(telemetry_ticks() - ticks) / (telemetry_now_ns() - ns);
+#else
+    return 1.0;
+#endif
+}
+
+void telemetry_init(void)
+{
+    const char *name = getenv("HARNESS_TELEMETRY");
+    if (!name)
+        return;
+
+    // Whoever comes first creates it, zeroed, everyone else maps the same pages
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        printf("FAIL on %s: shm_open(%s), telemetry is off\n", __func__, name);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (st.st_size && st.st_size != sizeof(struct telemetry_segment)) ||
+        ftruncate(fd, sizeof(struct telemetry_segment)))
+    {
+        printf("FAIL on %s: %s has another layout, telemetry is off\n", __func__, name);
+        close(fd);
+        return;
+    }
+
+    struct telemetry_segment *segment =
+        mmap(NULL, sizeof(struct telemetry_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        printf("FAIL on %s: mmap(), telemetry is off\n", __func__);
+        return;
+    }
+
+    unsigned expected = 0;
+    if (__atomic_compare_exchange_n(&segment->magic, &expected, TELEMETRY_CALIBRATING, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+    {
+        segment->version = TELEMETRY_VERSION;
+        segment->ticks_per_ns = telemetry_calibrate();
+        __atomic_store_n(&segment->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (expected == TELEMETRY_MAGIC && segment->version != TELEMETRY_VERSION)
+    {
+        printf("FAIL on %s: %s is version %u, telemetry is off\n", __func__, name, segment->version);
+        munmap(segment, sizeof(struct telemetry_segment));
+        return;
+    }
+
+    telemetry = segment;
+}
+
+static void telemetry_add(struct telemetry_histogram *histogram, unsigned long long value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void telemetry_begin(struct telemetry_mark *mark, const struct arena *arena)
+{
+    if (!telemetry)
+        return;
+
+    mark->requested = arena->requested;
+    mark->allocations = arena->allocations;
+    mark->ticks = telemetry_ticks();
+}
+
+void telemetry_end(enum telemetry_stage stage, const struct telemetry_mark *mark, const struct arena *arena)
+{
+    if (!telemetry)
+        return;
+
+    unsigned long long ticks = telemetry_ticks() - mark->ticks;
+
+    // The arena is reset between inputs, never within one
+    telemetry_add(&telemetry->stages[stage][TELEMETRY_TICKS], ticks);
+    telemetry_add(&telemetry->stages[stage][TELEMETRY_BYTES], arena->requested - mark->requested);
+    telemetry_add(&telemetry->stages[stage][TELEMETRY_ALLOCATIONS], arena->allocations - mark->allocations);
+}
+
+void telemetry_input(void)
+{
+    if (telemetry)
+        __atomic_fetch_add(&telemetry->inputs, 1, __ATOMIC_RELAXED);
+}
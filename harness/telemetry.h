@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+
+struct arena;
+
+// Per-stage latency and allocation histograms, in a shared memory segment
+// that every harness process adds to lock-free, so that the -n$(nproc)
+// workers of a campaign all land in the same place. Enabled by naming the
+// segment with HARNESS_TELEMETRY=/name, read live with tools/telemetry
+// (which only depends on this header). Times are in TSC ticks, nanoseconds
+// off x86. Bytes and allocations are the arena's, which libpng allocates
+// from everywhere but inside the simplified API.
+#define TELEMETRY_MAGIC 0x706e6774u // "pngt"
+#define TELEMETRY_VERSION 1
+
+// log2 buckets: 0 holds zeroes, N holds [2^(N-1), 2^N)
+#define TELEMETRY_BUCKETS 65
+
+enum telemetry_stage
+{
+    TELEMETRY_PNGTOPNG,
+    TELEMETRY_EXAMPLE1,
+    TELEMETRY_READ,
+    TELEMETRY_PROCESS,
+    TELEMETRY_WRITE,
+    TELEMETRY_STREAM,
+    TELEMETRY_PROGRESSIVE,
+    TELEMETRY_STAGES,
+};
+
+enum telemetry_metric
+{
+    TELEMETRY_TICKS,
+    TELEMETRY_BYTES,
+    TELEMETRY_ALLOCATIONS,
+    TELEMETRY_METRICS,
+};
+
+struct telemetry_histogram
+{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[TELEMETRY_BUCKETS];
+};
+
+struct telemetry_segment
+{
+    unsigned magic; // Set last, once ticks_per_ns is known
+    unsigned version;
+    double ticks_per_ns;
+    unsigned long long inputs;
+    struct telemetry_histogram stages[TELEMETRY_STAGES][TELEMETRY_METRICS];
+};
+
+// Where a stage started
+struct telemetry_mark
+{
+    unsigned long long ticks;
+    size_t requested;
+    size_t allocations;
+};
+
+// NULL unless HARNESS_TELEMETRY is set
+extern struct telemetry_segment *telemetry;
+
+void telemetry_init(void);
+
+// Brackets a stage; both are no-ops with telemetry off
+void telemetry_begin(struct telemetry_mark *mark, const struct arena *arena);
+void telemetry_end(enum telemetry_stage stage, const struct telemetry_mark *mark, const struct arena *arena);
+void telemetry_input(void);
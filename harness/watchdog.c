@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "watchdog.h"
+
+// Every stage at its budget still stays within honggfuzz's -t3
+unsigned long long watchdog_budgets[WATCHDOG_STAGES] = {
+    [WATCHDOG_PNGTOPNG] = 500000000,
+    [WATCHDOG_EXAMPLE1] = 500000000,
+    [WATCHDOG_DECODE] = 500000000,
+    [WATCHDOG_PROGRESSIVE] = 500000000,
+};
+
+struct watchdog_stats watchdog_stats;
+
+static const char *watchdog_names[WATCHDOG_STAGES] = {
+    [WATCHDOG_PNGTOPNG] = "pngtopng",
+    [WATCHDOG_EXAMPLE1] = "example1",
+    [WATCHDOG_DECODE] = "decode",
+    [WATCHDOG_PROGRESSIVE] = "progressive",
+};
+
+// The stage running on this thread
+static __thread struct
+{
+    int active;
+    enum watchdog_stage stage;
+    unsigned long long start;
+    unsigned long long deadline; // 0 without a budget
+} watchdog_current;
+
+// Called from any decoding thread
+static void watchdog_max(unsigned long long *slot, unsigned long long value)
+{
+    unsigned long long current = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(slot, &current, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static unsigned long long watchdog_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void watchdog_init(void)
+{
+    const char *spec = getenv("HARNESS_BUDGETS");
+    if (!spec)
+        return;
+
+    char *copy = strdup(spec), *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (!value)
+        {
+            printf("Ignoring malformed budget %s\n", item);
+            continue;
+        }
+        *value++ = '\0';
+
+        unsigned long long ns = strtoull(value, NULL, 0) * 1000000ull;
+        int found = 0;
+        for (int i = 0; i < WATCHDOG_STAGES; i++)
+            if (!strcmp(item, watchdog_names[i]) || !strcmp(item, "all"))
+            {
+                watchdog_budgets[i] = ns;
+                found = 1;
+            }
+
+        if (!found)
+            printf("Ignoring unknown budget %s\n", item);
+    }
+    free(copy);
+}
+
+void watchdog_report(void)
+{
+    printf("Watchdog over budget:");
+    for (int i = 0; i < WATCHDOG_STAGES; i++)
+        printf(" %s=%llu", watchdog_names[i], watchdog_stats.over[i]);
+
+    printf(", slowest:");
+    for (int i = 0; i < WATCHDOG_STAGES; i++)
+        printf(" %s=%.1fms", watchdog_names[i], watchdog_stats.slowest[i] / 1e6);
+    printf("\n");
+}
+
+void watchdog_begin(enum watchdog_stage stage)
+{
+    watchdog_current.active = 1;
+    watchdog_current.stage = stage;
+    watchdog_current.start = watchdog_now();
+    watchdog_current.deadline = watchdog_budgets[stage] ? watchdog_current.start + watchdog_budgets[stage] : 0;
+}
+
+void watchdog_end(void)
+{
+    enum watchdog_stage stage = watchdog_current.stage;
+    unsigned long long elapsed = watchdog_now() - watchdog_current.start;
+
+    watchdog_current.active = 0;
+
+    if (watchdog_budgets[stage] && elapsed > watchdog_budgets[stage])
+        __atomic_fetch_add(&watchdog_stats.over[stage], 1, __ATOMIC_RELAXED);
+
+    watchdog_max(&watchdog_stats.slowest[stage], elapsed);
+}
+
+void watchdog_check(png_structp png_ptr)
+{
+    if (!watchdog_current.active || !watchdog_current.deadline)
+        return;
+
+    unsigned long long now = watchdog_now();
+    if (now <= watchdog_current.deadline)
+        return;
+
+    // Only once, the stage's own cleanup may still call back into libpng
+    watchdog_current.deadline = 0;
+
+    char message[96];
+    snprintf(message, sizeof(message), "watchdog: %s over its %llums budget after %.1fms",
+             watchdog_names[watchdog_current.stage], watchdog_budgets[watchdog_current.stage] / 1000000,
+             (now - watchdog_current.start) / 1e6);
+    png_error(png_ptr, message);
+}
+
+void watchdog_row_fn(png_structp png_ptr, png_uint_32 row, int pass)
+{
+    watchdog_check(png_ptr);
+}
+
+void watchdog_merge(struct watchdog_stats *into, const struct watchdog_stats *from)
+{
+    for (int i = 0; i < WATCHDOG_STAGES; i++)
+    {
+        __atomic_fetch_add(&into->over[i], from->over[i], __ATOMIC_RELAXED);
+        watchdog_max(&into->slowest[i], from->slowest[i]);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <png.h>
+
+// Per-stage time budgets, checked from libpng's row and read callbacks. A
+// stage over its budget is aborted through png_error(), the same longjmp()
+// path as any libpng error, and the input moves on to the next stage.
+// Set in milliseconds with HARNESS_BUDGETS="pngtopng=N,example1=N,decode=N,
+// progressive=N,all=N", 0 disables a budget. The simplified API hides its
+// png_struct, so pngtopng is only measured, never aborted.
+enum watchdog_stage
+{
+    WATCHDOG_PNGTOPNG,
+    WATCHDOG_EXAMPLE1,
+    WATCHDOG_DECODE,
+    WATCHDOG_PROGRESSIVE,
+    WATCHDOG_STAGES,
+};
+
+struct watchdog_stats
+{
+    unsigned long long over[WATCHDOG_STAGES];    // Stages that ran past their budget
+    unsigned long long slowest[WATCHDOG_STAGES]; // Nanoseconds
+};
+
+extern unsigned long long watchdog_budgets[WATCHDOG_STAGES]; // Nanoseconds
+extern struct watchdog_stats watchdog_stats;
+
+void watchdog_init(void);
+void watchdog_report(void);
+
+// Brackets a stage on the calling thread
+void watchdog_begin(enum watchdog_stage stage);
+void watchdog_end(void);
+
+// Aborts the current stage through png_error() once it is over budget
+void watchdog_check(png_structp png_ptr);
+
+// png_set_read_status_fn() / png_set_write_status_fn() callback
+void watchdog_row_fn(png_structp png_ptr, png_uint_32 row, int pass);
+
+// Adds a worker's statistics to shared ones
+void watchdog_merge(struct watchdog_stats *into, const struct watchdog_stats *from);
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "chunks.h"
+
+static const uint8_t png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+uint32_t chunk_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void chunk_put_be32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+int chunk_insert(struct chunk_file *file, size_t index, const char type[4], const uint8_t *data, uint32_t length)
+{
+    if (file->count == file->capacity)
+    {
+        size_t capacity = file->capacity ? file->capacity * 2 : 16;
+        struct chunk *chunks = realloc(file->chunks, capacity * sizeof(struct chunk));
+        if (!chunks)
+            return 1;
+
+        file->chunks = chunks;
+        file->capacity = capacity;
+    }
+
+    // Never NULL, so that chunks can always be resized and written
+    uint8_t *copy = malloc(length ? length : 1);
+    if (!copy)
+        return 1;
+    if (length)
+        memcpy(copy, data, length);
+
+    memmove(&file->chunks[index + 1], &file->chunks[index], (file->count - index) * sizeof(struct chunk));
+    memcpy(file->chunks[index].type, type, 4);
+    file->chunks[index].data = copy;
+    file->chunks[index].length = length;
+    file->count++;
+    return 0;
+}
+
+void chunk_remove(struct chunk_file *file, size_t index)
+{
+    free(file->chunks[index].data);
+    memmove(&file->chunks[index], &file->chunks[index + 1], (file->count - index - 1) * sizeof(struct chunk));
+    file->count--;
+}
+
+// New bytes are zeroed
+int chunk_resize(struct chunk *chunk, uint32_t length)
+{
+    uint8_t *data = realloc(chunk->data, length ? length : 1);
+    if (!data)
+        return 1;
+
+    if (length > chunk->length)
+        memset(data + chunk->length, 0, length - chunk->length);
+
+    chunk->data = data;
+    chunk->length = length;
+    return 0;
+}
+
+struct chunk *chunk_find(struct chunk_file *file, const char type[4])
+{
+    for (size_t i = 0; i < file->count; i++)
+        if (!memcmp(file->chunks[i].type, type, 4))
+            return &file->chunks[i];
+
+    return NULL;
+}
+
+int chunk_file_parse(struct chunk_file *file, const uint8_t *data, size_t size)
+{
+    size_t offset = 0;
+
+    memset(file, 0, sizeof(*file));
+
+    if (size >= 8 && !memcmp(data, png_signature, 8))
+    {
+        file->signature = 1;
+        offset = 8;
+
+        // Stops at the first chunk that does not fit, that one goes to the tail
+        while (size - offset >= 12)
+        {
+            uint32_t length = chunk_be32(data + offset);
+            if (length > size - offset - 12)
+                break;
+
+            if (chunk_insert(file, file->count, (const char *)data + offset + 4, data + offset + 8, length))
+                goto fail;
+            offset += (size_t)length + 12;
+        }
+    }
+
+    file->tail_size = size - offset;
+    file->tail = malloc(file->tail_size ? file->tail_size : 1);
+    if (!file->tail)
+        goto fail;
+    if (file->tail_size)
+        memcpy(file->tail, data + offset, file->tail_size);
+
+    return 0;
+
+fail:
+    chunk_file_free(file);
+    return 1;
+}
+
+size_t chunk_file_size(const struct chunk_file *file)
+{
+    size_t size = file->signature ? 8 : 0;
+
+    for (size_t i = 0; i < file->count; i++)
+        size += (size_t)file->chunks[i].length + 12;
+
+    return size + file->tail_size;
+}
+
+int chunk_file_write(const struct chunk_file *file, uint8_t **data, size_t *size)
+{
+    *size = chunk_file_size(file);
+    *data = malloc(*size ? *size : 1);
+    if (!*data)
+        return 1;
+
+    uint8_t *p = *data;
+    if (file->signature)
+    {
+        memcpy(p, png_signature, 8);
+        p += 8;
+    }
+
+    for (size_t i = 0; i < file->count; i++)
+    {
+        const struct chunk *chunk = &file->chunks[i];
+
+        chunk_put_be32(p, chunk->length);
+        memcpy(p + 4, chunk->type, 4);
+        memcpy(p + 8, chunk->data, chunk->length);
+
+        // The CRC covers the type and the data
+        uLong crc = crc32(0, p + 4, chunk->length + 4);
+        chunk_put_be32(p + 8 + chunk->length, crc);
+        p += (size_t)chunk->length + 12;
+    }
+
+    if (file->tail_size)
+        memcpy(p, file->tail, file->tail_size);
+
+    return 0;
+}
+
+void chunk_file_free(struct chunk_file *file)
+{
+    for (size_t i = 0; i < file->count; i++)
+        free(file->chunks[i].data);
+
+    free(file->chunks);
+    free(file->tail);
+    memset(file, 0, sizeof(*file));
+}
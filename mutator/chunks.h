@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A PNG file as a list of chunks. Lengths and CRCs are not stored, they are
+// recomputed when the file is written back, whatever was done to the chunks.
+struct chunk
+{
+    char type[4];
+    uint8_t *data;
+    uint32_t length;
+};
+
+struct chunk_file
+{
+    int signature; // Starts with the PNG signature, otherwise everything is in tail
+
+    struct chunk *chunks;
+    size_t count;
+    size_t capacity;
+
+    uint8_t *tail; // Whatever follows the last complete chunk
+    size_t tail_size;
+};
+
+int chunk_file_parse(struct chunk_file *file, const uint8_t *data, size_t size);
+int chunk_file_write(const struct chunk_file *file, uint8_t **data, size_t *size);
+size_t chunk_file_size(const struct chunk_file *file);
+void chunk_file_free(struct chunk_file *file);
+
+// index may be file->count to append; the chunk takes ownership of a copy of data
+int chunk_insert(struct chunk_file *file, size_t index, const char type[4], const uint8_t *data, uint32_t length);
+void chunk_remove(struct chunk_file *file, size_t index);
+int chunk_resize(struct chunk *chunk, uint32_t length);
+struct chunk *chunk_find(struct chunk_file *file, const char type[4]);
+
+uint32_t chunk_be32(const uint8_t *p);
+void chunk_put_be32(uint8_t *p, uint32_t value);
@@ -0,0 +1,418 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "mutator.h"
+
+// Byte flips in a deflate stream nearly always break it, so compressed payloads
+// are inflated, mutated as what they really are (filtered scanlines for IDAT,
+// text or an ICC profile otherwise) and deflated again with random settings.
+// deflate() takes care of the Adler-32, the chunk writer of the CRCs.
+
+// Inflated payloads are capped, a decompression bomb would stall every execution
+#define INFLATE_MAX (16 << 20)
+#define ROWS_MAX (1 << 16)
+
+struct buffer
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+static int buffer_reserve(struct buffer *buffer, size_t size)
+{
+    if (size <= buffer->capacity)
+        return 0;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+    while (capacity < size)
+        capacity *= 2;
+
+    uint8_t *data = realloc(buffer->data, capacity);
+    if (!data)
+        return 1;
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+// A damaged stream still yields whatever came before the damage
+static int inflate_payload(const uint8_t *data, size_t size, struct buffer *out)
+{
+    z_stream zs;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+    memset(out, 0, sizeof(*out));
+    if (inflateInit(&zs) != Z_OK)
+        return 1;
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = size;
+
+    for (;;)
+    {
+        if (out->size == out->capacity)
+        {
+            if (out->capacity >= INFLATE_MAX || buffer_reserve(out, out->capacity ? out->capacity * 2 : size * 4 + 1024))
+                break;
+        }
+
+        zs.next_out = out->data + out->size;
+        zs.avail_out = out->capacity - out->size;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        out->size = out->capacity - zs.avail_out;
+
+        if (ret == Z_STREAM_END || (ret != Z_OK && !(ret == Z_BUF_ERROR && !zs.avail_out)))
+            break;
+    }
+
+    inflateEnd(&zs);
+    return 0;
+}
+
+static int deflate_payload(const uint8_t *data, size_t size, struct buffer *out)
+{
+    static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(zs));
+    memset(out, 0, sizeof(*out));
+
+    // The window size also ends up in the zlib header, which libpng inspects
+    int level = below(10), window = 9 + below(7), strategy = strategies[below(5)];
+    if (deflateInit2(&zs, level, Z_DEFLATED, window, 1 + below(9), strategy) != Z_OK)
+        return 1;
+
+    if (buffer_reserve(out, deflateBound(&zs, size)))
+    {
+        deflateEnd(&zs);
+        return 1;
+    }
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = size;
+    zs.next_out = out->data;
+    zs.avail_out = out->capacity;
+
+    int ret = deflate(&zs, Z_FINISH);
+    out->size = zs.total_out;
+    deflateEnd(&zs);
+
+    return ret != Z_STREAM_END;
+}
+
+static void mutate_bytes(struct buffer *raw)
+{
+    unsigned count = 1 + below(8);
+
+    for (unsigned i = 0; raw->size && i < count; i++)
+        raw->data[below(raw->size)] = below(2) ? rng() : interesting(0);
+}
+
+// Truncate anywhere, or append garbage
+static int mutate_size(struct buffer *raw, size_t at)
+{
+    if (below(2))
+    {
+        raw->size = at;
+        return 0;
+    }
+
+    size_t extra = 1 + below(below(2) ? 16 : 4096);
+    if (buffer_reserve(raw, raw->size + extra))
+        return 1;
+
+    random_bytes(raw->data + raw->size, extra);
+    raw->size += extra;
+    return 0;
+}
+
+struct scanlines
+{
+    size_t *rows; // Offset of each row's filter byte
+    size_t count;
+    size_t passes[8]; // Offset where each pass starts, passes[7] is the end
+};
+
+// Lays the IHDR geometry over the inflated data, Adam7 passes included
+static int scanlines_layout(struct chunk_file *file, size_t size, struct scanlines *lines)
+{
+    static const unsigned channels[7] = {1, 0, 3, 1, 2, 0, 4};
+    static const uint32_t x0[7] = {0, 4, 0, 2, 0, 1, 0}, y0[7] = {0, 0, 4, 0, 2, 0, 1};
+    static const uint32_t dx[7] = {8, 8, 4, 4, 2, 2, 1}, dy[7] = {8, 8, 8, 4, 4, 2, 2};
+
+    struct chunk *ihdr = chunk_find(file, "IHDR");
+    if (!ihdr || ihdr->length < 13)
+        return 1;
+
+    uint32_t width = chunk_be32(ihdr->data), height = chunk_be32(ihdr->data + 4);
+    unsigned depth = ihdr->data[8], color = ihdr->data[9], interlace = ihdr->data[12] == 1;
+    if (!width || !height || !depth || depth > 16 || color > 6 || !channels[color])
+        return 1;
+
+    lines->rows = malloc(ROWS_MAX * sizeof(size_t));
+    if (!lines->rows)
+        return 1;
+    lines->count = 0;
+
+    size_t offset = 0;
+    for (int pass = 0; pass < 7; pass++)
+    {
+        lines->passes[pass] = offset;
+
+        uint64_t pass_width = interlace ? (width > x0[pass] ? (width - x0[pass] + dx[pass] - 1) / dx[pass] : 0) : width;
+        uint64_t pass_height = interlace ? (height > y0[pass] ? (height - y0[pass] + dy[pass] - 1) / dy[pass] : 0) : height;
+        uint64_t rowbytes = (pass_width * depth * channels[color] + 7) / 8;
+
+        for (uint64_t y = 0; pass_width && y < pass_height && offset < size && lines->count < ROWS_MAX; y++)
+        {
+            lines->rows[lines->count++] = offset;
+            offset += 1 + rowbytes;
+        }
+
+        if (!interlace)
+        {
+            for (int rest = pass + 1; rest < 8; rest++)
+                lines->passes[rest] = offset;
+            break;
+        }
+    }
+    lines->passes[7] = offset;
+
+    if (!lines->count)
+    {
+        free(lines->rows);
+        return 1;
+    }
+    return 0;
+}
+
+static int mutate_scanlines(struct chunk_file *file, struct buffer *raw)
+{
+    struct scanlines lines;
+
+    if (scanlines_layout(file, raw->size, &lines))
+    {
+        mutate_bytes(raw);
+        return 0;
+    }
+
+    size_t row = lines.rows[below(lines.count)];
+    size_t row_end = row + 1 + below(64);
+    int result = 0;
+
+    switch (below(5))
+    {
+    case 0:
+        // One filter type byte: valid (0-4) or not
+        raw->data[row] = below(4) ? below(5) : rng();
+        break;
+    case 1:
+    {
+        // The same filter on every row, so each filter's undo code runs end to end
+        uint8_t filter = below(5);
+        for (size_t i = 0; i < lines.count; i++)
+            raw->data[lines.rows[i]] = filter;
+        break;
+    }
+    case 2:
+        // Pixel bytes of one row
+        for (size_t i = row + 1; i < row_end && i < raw->size; i++)
+            if (!below(4))
+                raw->data[i] = below(2) ? (uint8_t)rng() : raw->data[i] ^ (1 << below(8));
+        break;
+    case 3:
+    {
+        // Cut or pad around a pass boundary (or the end of the image)
+        size_t boundary = lines.passes[1 + below(7)];
+        size_t jitter = below(5);
+        size_t at = boundary + jitter >= 2 ? boundary + jitter - 2 : 0;
+        result = mutate_size(raw, at < raw->size ? at : raw->size);
+        break;
+    }
+    default:
+        result = mutate_size(raw, below(raw->size + 1));
+        break;
+    }
+
+    free(lines.rows);
+    return result;
+}
+
+static int mutate_idat(struct chunk_file *file)
+{
+    struct buffer stream = {0}, raw, compressed;
+    size_t first = file->count;
+    int result = 1;
+
+    // libpng reads the IDAT chunks as one zlib stream
+    for (size_t i = 0; i < file->count; i++)
+        if (!memcmp(file->chunks[i].type, "IDAT", 4))
+        {
+            if (first == file->count)
+                first = i;
+            if (!file->chunks[i].length)
+                continue;
+            if (buffer_reserve(&stream, stream.size + file->chunks[i].length))
+                goto fail_stream;
+            memcpy(stream.data + stream.size, file->chunks[i].data, file->chunks[i].length);
+            stream.size += file->chunks[i].length;
+        }
+
+    if (first == file->count || inflate_payload(stream.data, stream.size, &raw))
+        goto fail_stream;
+
+    if (mutate_scanlines(file, &raw) || deflate_payload(raw.data, raw.size, &compressed))
+        goto fail_raw;
+
+    if (compressed.size > MUTATOR_MAX_SIZE / 2)
+        goto fail_compressed;
+
+    for (size_t i = file->count; i-- > first;)
+        if (!memcmp(file->chunks[i].type, "IDAT", 4))
+            chunk_remove(file, i);
+
+    // Split at random, libpng has to stitch the stream back together
+    size_t offset = 0, at = first;
+    while (offset < compressed.size || at == first)
+    {
+        size_t length = below(4) ? compressed.size - offset : below(compressed.size - offset + 1);
+        if (chunk_insert(file, at++, "IDAT", compressed.data + offset, length))
+            goto fail_compressed;
+        offset += length;
+    }
+    result = 0;
+
+fail_compressed:
+    free(compressed.data);
+
+fail_raw:
+    free(raw.data);
+
+fail_stream:
+    free(stream.data);
+    return result;
+}
+
+// Text (zTXt, iTXt) or an ICC profile (iCCP)
+static int mutate_payload(const char *type, struct buffer *raw)
+{
+    if (!memcmp(type, "iCCP", 4) && raw->size >= 132 && below(2))
+    {
+        // Header fields libpng validates: profile size, 'acsp' signature, tag count
+        switch (below(3))
+        {
+        case 0:
+            chunk_put_be32(raw->data, below(2) ? interesting(chunk_be32(raw->data)) : raw->size);
+            break;
+        case 1:
+            raw->data[36 + below(4)] = rng();
+            break;
+        default:
+            chunk_put_be32(raw->data + 128, interesting(chunk_be32(raw->data + 128)));
+            break;
+        }
+        return 0;
+    }
+
+    switch (below(3))
+    {
+    case 0:
+        mutate_bytes(raw);
+        return 0;
+    case 1:
+        return mutate_size(raw, below(raw->size + 1));
+    default:
+    {
+        // Repeat the payload, for the decompression limits
+        size_t size = raw->size ? raw->size : 1;
+        size_t target = size * (2 + below(64));
+        if (target > INFLATE_MAX / 4 || buffer_reserve(raw, target))
+            return 1;
+        if (!raw->size)
+            raw->data[raw->size++] = 'A';
+        while (raw->size * 2 <= target)
+        {
+            memcpy(raw->data + raw->size, raw->data, raw->size);
+            raw->size *= 2;
+        }
+        return 0;
+    }
+    }
+}
+
+static int mutate_text(struct chunk_file *file)
+{
+    struct buffer raw, compressed;
+    size_t candidates[64], count = 0;
+    int result = 1;
+
+    for (size_t i = 0; i < file->count && count < 64; i++)
+        if (!memcmp(file->chunks[i].type, "zTXt", 4) || !memcmp(file->chunks[i].type, "iTXt", 4) || !memcmp(file->chunks[i].type, "iCCP", 4))
+            candidates[count++] = i;
+    if (!count)
+        return 1;
+
+    struct chunk *chunk = &file->chunks[candidates[below(count)]];
+
+    // keyword\0 method data (zTXt, iCCP) or keyword\0 flag method lang\0 translated\0 text (iTXt)
+    uint8_t *nul = memchr(chunk->data, 0, chunk->length);
+    if (!nul)
+        return 1;
+    size_t offset = nul - chunk->data + 2, flag = 0;
+
+    if (!memcmp(chunk->type, "iTXt", 4))
+    {
+        flag = offset - 1;
+        offset++;
+        for (int i = 0; i < 2 && offset <= chunk->length; i++)
+        {
+            nul = memchr(chunk->data + offset, 0, chunk->length - offset);
+            if (!nul)
+                return 1;
+            offset = nul - chunk->data + 1;
+        }
+    }
+    if (offset > chunk->length)
+        return 1;
+
+    // Uncompressed iTXt text gets compressed, the flag says so
+    if (flag && !chunk->data[flag])
+    {
+        memset(&raw, 0, sizeof(raw));
+        if (buffer_reserve(&raw, chunk->length - offset + 1))
+            return 1;
+        memcpy(raw.data, chunk->data + offset, chunk->length - offset);
+        raw.size = chunk->length - offset;
+        chunk->data[flag] = 1;
+        chunk->data[flag + 1] = 0;
+    }
+    else if (inflate_payload(chunk->data + offset, chunk->length - offset, &raw))
+    {
+        return 1;
+    }
+
+    if (mutate_payload(chunk->type, &raw) || deflate_payload(raw.data, raw.size, &compressed))
+        goto fail_raw;
+
+    if (offset + compressed.size > MUTATOR_MAX_SIZE / 2 || chunk_resize(chunk, offset + compressed.size))
+        goto fail_compressed;
+
+    memcpy(chunk->data + offset, compressed.data, compressed.size);
+    result = 0;
+
+fail_compressed:
+    free(compressed.data);
+
+fail_raw:
+    free(raw.data);
+    return result;
+}
+
+int mutate_compressed(struct chunk_file *file)
+{
+    return below(3) ? mutate_idat(file) : mutate_text(file);
+}
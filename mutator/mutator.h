@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunks.h"
+
+#define MUTATOR_MAX_SIZE (1 << 20)
+
+// Trailing pipeline and transform selector, see harness/selector.h
+#define SELECTOR_SIZE 8
+
+// Shared by all mutation stages, seeded once per run (png_mutator.c)
+uint64_t rng(void);
+size_t below(size_t n);
+uint32_t interesting(uint32_t current);
+void random_bytes(uint8_t *data, size_t length);
+
+// Inflate an IDAT/zTXt/iTXt/iCCP payload, mutate it, deflate it back (deflate.c)
+int mutate_compressed(struct chunk_file *file);
@@ -0,0 +1,453 @@
+/*
+ * Structure-aware PNG mutator, run by honggfuzz on every input it generates:
+ *
+ *   honggfuzz --pprocess_cmd mutator/build/png_mutator ...
+ *
+ * Usage: png_mutator <file>
+ *
+ * The file is rewritten in place. It is parsed into chunks, a few chunk level
+ * mutations are applied (insert, delete, duplicate, move, splice from another
+ * corpus file, typed IHDR/PLTE/tRNS/gAMA/iCCP fields, compressed payloads in
+ * deflate.c, the trailing harness selector), and every length and CRC is
+ * recomputed on the way out, so that libpng does not reject the input in
+ * png_crc_finish() before reaching anything interesting.
+ *
+ * Environment:
+ *   PNG_MUTATOR_CORPUS     Directory to splice chunks from (none by default)
+ *   PNG_MUTATOR_MUTATIONS  Up to this many mutations per input (default 4)
+ *   PNG_MUTATOR_SEED       Fixed seed, to replay a mutation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "mutator.h"
+
+static uint64_t rng_state;
+
+uint64_t rng(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+size_t below(size_t n)
+{
+    return n ? rng() % n : 0;
+}
+
+static const uint32_t interesting32[] = {
+    0, 1, 2, 3, 7, 8, 15, 16, 31, 32, 63, 64, 127, 128, 255, 256, 257, 1000, 1024, 4096, 65535, 65536,
+    1000000, 0x7ffffffe, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+};
+
+uint32_t interesting(uint32_t current)
+{
+    switch (below(4))
+    {
+    case 0:
+        return current + 1;
+    case 1:
+        return current - 1;
+    case 2:
+        return rng() & 0xffff;
+    default:
+        return interesting32[below(sizeof(interesting32) / sizeof(interesting32[0]))];
+    }
+}
+
+void random_bytes(uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        data[i] = rng();
+}
+
+// Chunks worth inserting from scratch, with plausible sizes
+static const struct
+{
+    char type[5];
+    uint32_t length;
+} known_chunks[] = {
+    {"IHDR", 13}, {"PLTE", 48}, {"IDAT", 32}, {"IEND", 0}, {"tRNS", 6}, {"gAMA", 4}, {"cHRM", 32},
+    {"sRGB", 1}, {"iCCP", 24}, {"sBIT", 4}, {"bKGD", 6}, {"hIST", 32}, {"pHYs", 9}, {"sPLT", 24},
+    {"tIME", 7}, {"tEXt", 16}, {"zTXt", 24}, {"iTXt", 24}, {"oFFs", 9}, {"pCAL", 32}, {"sCAL", 8},
+    {"eXIf", 16}, {"acTL", 8}, {"fcTL", 26}, {"fdAT", 32},
+};
+
+static int mutate_insert(struct chunk_file *file)
+{
+    uint8_t data[64];
+    char type[4];
+    uint32_t length;
+
+    size_t known = below(sizeof(known_chunks) / sizeof(known_chunks[0]) + 1);
+    if (known < sizeof(known_chunks) / sizeof(known_chunks[0]))
+    {
+        memcpy(type, known_chunks[known].type, 4);
+        length = known_chunks[known].length;
+    }
+    else
+    {
+        // Unknown ancillary chunk, exercises the unknown/user chunk paths
+        for (int i = 0; i < 4; i++)
+            type[i] = 'a' + below(26);
+        length = below(sizeof(data));
+    }
+
+    random_bytes(data, length);
+    return chunk_insert(file, below(file->count + 1), type, data, length);
+}
+
+static int mutate_delete(struct chunk_file *file)
+{
+    if (file->count < 2)
+        return 1;
+
+    chunk_remove(file, below(file->count));
+    return 0;
+}
+
+static int mutate_duplicate(struct chunk_file *file)
+{
+    if (!file->count)
+        return 1;
+
+    struct chunk chunk = file->chunks[below(file->count)];
+    return chunk_insert(file, below(file->count + 1), chunk.type, chunk.data, chunk.length);
+}
+
+static int mutate_move(struct chunk_file *file)
+{
+    if (file->count < 2)
+        return 1;
+
+    size_t from = below(file->count), to = below(file->count);
+    struct chunk chunk = file->chunks[from];
+
+    if (from < to)
+        memmove(&file->chunks[from], &file->chunks[from + 1], (to - from) * sizeof(struct chunk));
+    else
+        memmove(&file->chunks[to + 1], &file->chunks[to], (from - to) * sizeof(struct chunk));
+    file->chunks[to] = chunk;
+    return 0;
+}
+
+static int mutate_splice(struct chunk_file *file)
+{
+    const char *corpus = getenv("PNG_MUTATOR_CORPUS");
+    struct chunk_file donor;
+    struct dirent *dirent;
+    char path[4096] = "";
+    size_t seen = 0;
+
+    if (!corpus)
+        return 1;
+
+    // Reservoir sampling, the corpus is only listed once
+    DIR *dir = opendir(corpus);
+    if (!dir)
+        return 1;
+    while ((dirent = readdir(dir)))
+        if (dirent->d_name[0] != '.' && !below(++seen))
+            snprintf(path, sizeof(path), "%s/%s", corpus, dirent->d_name);
+    closedir(dir);
+
+    FILE *fp = path[0] ? fopen(path, "rb") : NULL;
+    if (!fp)
+        return 1;
+
+    uint8_t *data = malloc(MUTATOR_MAX_SIZE);
+    size_t size = data ? fread(data, 1, MUTATOR_MAX_SIZE, fp) : 0;
+    fclose(fp);
+
+    int result = 1;
+    if (data && !chunk_file_parse(&donor, data, size))
+    {
+        if (donor.count)
+        {
+            // A run of consecutive chunks, so that PLTE+tRNS or IDAT sequences travel together
+            size_t first = below(donor.count);
+            size_t run = 1 + below(donor.count - first < 4 ? donor.count - first : 4);
+            size_t at = below(file->count + 1);
+
+            result = 0;
+            for (size_t i = 0; i < run && !result; i++)
+            {
+                struct chunk *chunk = &donor.chunks[first + i];
+                result = chunk_insert(file, at + i, chunk->type, chunk->data, chunk->length);
+            }
+        }
+        chunk_file_free(&donor);
+    }
+
+    free(data);
+    return result;
+}
+
+static int mutate_ihdr(struct chunk *chunk)
+{
+    if (chunk->length != 13 && below(4) && chunk_resize(chunk, 13))
+        return 1;
+    if (chunk->length < 13)
+        return 0;
+
+    switch (below(6))
+    {
+    case 0:
+        chunk_put_be32(chunk->data, interesting(chunk_be32(chunk->data)));
+        break;
+    case 1:
+        chunk_put_be32(chunk->data + 4, interesting(chunk_be32(chunk->data + 4)));
+        break;
+    case 2:
+    {
+        static const uint8_t depths[] = {1, 2, 4, 8, 16, 0, 3, 32};
+        chunk->data[8] = depths[below(sizeof(depths))];
+        break;
+    }
+    case 3:
+    {
+        static const uint8_t colors[] = {0, 2, 3, 4, 6, 1, 5, 7};
+        chunk->data[9] = colors[below(sizeof(colors))];
+        break;
+    }
+    case 4:
+        chunk->data[10 + below(2)] = below(4) ? 0 : rng();
+        break;
+    default:
+        chunk->data[12] = below(4) ? below(2) : rng();
+        break;
+    }
+
+    return 0;
+}
+
+static int mutate_plte(struct chunk *chunk)
+{
+    static const uint32_t entries[] = {0, 1, 2, 15, 16, 17, 255, 256, 257};
+
+    if (below(2))
+    {
+        uint32_t length = below(4) ? entries[below(sizeof(entries) / sizeof(entries[0]))] * 3 : below(800);
+        if (chunk_resize(chunk, length))
+            return 1;
+    }
+
+    unsigned bytes = chunk->length ? 1 + below(4) : 0;
+    for (unsigned i = 0; i < bytes; i++)
+        chunk->data[below(chunk->length)] = rng();
+    return 0;
+}
+
+static int mutate_trns(struct chunk *chunk)
+{
+    static const uint32_t lengths[] = {0, 1, 2, 6, 16, 255, 256, 257};
+
+    if (below(2) && chunk_resize(chunk, lengths[below(sizeof(lengths) / sizeof(lengths[0]))]))
+        return 1;
+
+    // Gray and RGB keys are 16 bit samples, often above the bit depth
+    for (uint32_t i = 0; i + 1 < chunk->length && i < 6; i += 2)
+        if (below(2))
+        {
+            uint32_t sample = interesting(chunk->data[i] << 8 | chunk->data[i + 1]);
+            chunk->data[i] = sample >> 8;
+            chunk->data[i + 1] = sample;
+        }
+
+    return 0;
+}
+
+static int mutate_gama(struct chunk *chunk)
+{
+    static const uint32_t gammas[] = {0, 1, 45455, 45454, 100000, 220000, 1000000, 0x7fffffff, 0xffffffff};
+
+    if (chunk->length != 4 && below(4) && chunk_resize(chunk, 4))
+        return 1;
+    if (chunk->length < 4)
+        return 0;
+
+    chunk_put_be32(chunk->data, below(2) ? gammas[below(sizeof(gammas) / sizeof(gammas[0]))] : interesting(chunk_be32(chunk->data)));
+    return 0;
+}
+
+static int mutate_iccp(struct chunk *chunk)
+{
+    uint8_t *nul = memchr(chunk->data, 0, chunk->length);
+    size_t name = nul ? (size_t)(nul - chunk->data) : chunk->length;
+
+    switch (below(3))
+    {
+    case 0:
+    {
+        // Profile names must be 1-79 bytes
+        static const size_t names[] = {0, 1, 79, 80, 81};
+        size_t length = names[below(sizeof(names) / sizeof(names[0]))];
+        uint32_t rest = chunk->length - name;
+        uint8_t *copy = malloc(rest ? rest : 1);
+        if (!copy)
+            return 1;
+        memcpy(copy, chunk->data + name, rest);
+
+        if (chunk_resize(chunk, length + rest))
+        {
+            free(copy);
+            return 1;
+        }
+        memset(chunk->data, 'A' + below(26), length);
+        memcpy(chunk->data + length, copy, rest);
+        free(copy);
+        break;
+    }
+    case 1:
+        // Compression method, 0 is the only valid one
+        if (name + 1 < chunk->length)
+            chunk->data[name + 1] = below(2) ? 0 : rng();
+        break;
+    default:
+        // Truncate the compressed profile
+        if (name + 2 < chunk->length)
+            chunk_resize(chunk, name + 2 + below(chunk->length - name - 2));
+        break;
+    }
+
+    return 0;
+}
+
+static int mutate_typed(struct chunk_file *file)
+{
+    static const char *types[] = {"IHDR", "PLTE", "tRNS", "gAMA", "iCCP"};
+    const char *type = types[below(sizeof(types) / sizeof(types[0]))];
+
+    struct chunk *chunk = chunk_find(file, type);
+    if (!chunk)
+        return 1;
+
+    switch (type[0])
+    {
+    case 'I':
+        return mutate_ihdr(chunk);
+    case 'P':
+        return mutate_plte(chunk);
+    case 't':
+        return mutate_trns(chunk);
+    case 'g':
+        return mutate_gama(chunk);
+    default:
+        return mutate_iccp(chunk);
+    }
+}
+
+// The harness runs a single pipeline, with the transforms picked by a trailing
+// selector, for inputs that do not end with IEND
+static int mutate_selector(struct chunk_file *file)
+{
+    // Drop it now and then, so that every pipeline runs again
+    if (file->tail_size == SELECTOR_SIZE && !below(8))
+    {
+        file->tail_size = 0;
+        return 0;
+    }
+
+    if (file->tail_size != SELECTOR_SIZE)
+    {
+        uint8_t *tail = realloc(file->tail, SELECTOR_SIZE);
+        if (!tail)
+            return 1;
+
+        random_bytes(tail, SELECTOR_SIZE);
+        file->tail = tail;
+        file->tail_size = SELECTOR_SIZE;
+        return 0;
+    }
+
+    // Toggle one transform, or pick another pipeline, gamma or format
+    if (below(2))
+        file->tail[1 + below(3)] ^= 1 << below(8);
+    else
+        file->tail[below(SELECTOR_SIZE)] = rng();
+
+    return 0;
+}
+
+typedef int (*mutation_fn)(struct chunk_file *file);
+
+static const mutation_fn mutations[] = {
+    mutate_insert, mutate_delete, mutate_duplicate, mutate_move, mutate_splice, mutate_typed, mutate_typed,
+    mutate_compressed, mutate_compressed, mutate_compressed, mutate_selector, mutate_selector,
+};
+
+int main(int argc, char *argv[])
+{
+    struct chunk_file file;
+    uint8_t *data, *out;
+    size_t size, out_size;
+    int result = 1;
+
+    if (argc != 2)
+    {
+        printf("Usage: %s <file>\n", argv[0]);
+        return 1;
+    }
+
+    const char *seed = getenv("PNG_MUTATOR_SEED");
+    rng_state = seed ? strtoull(seed, NULL, 0) : (uint64_t)time(NULL) << 20 ^ getpid() ^ (uint64_t)clock() << 40;
+    rng_state |= 1;
+
+    const char *max = getenv("PNG_MUTATOR_MUTATIONS");
+    unsigned count = 1 + below(max && atoi(max) > 0 ? atoi(max) : 4);
+
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp)
+        return 1;
+
+    data = malloc(MUTATOR_MAX_SIZE + 1);
+    size = data ? fread(data, 1, MUTATOR_MAX_SIZE + 1, fp) : 0;
+    fclose(fp);
+
+    // Too big to be rewritten whole, leave it alone
+    if (size > MUTATOR_MAX_SIZE)
+        result = 0;
+
+    if (!data || size > MUTATOR_MAX_SIZE || chunk_file_parse(&file, data, size))
+        goto cleanup;
+
+    // Not a PNG: nothing to work on, leave honggfuzz's input alone
+    if (file.signature)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            mutations[below(sizeof(mutations) / sizeof(mutations[0]))](&file);
+
+            if (chunk_file_size(&file) > MUTATOR_MAX_SIZE)
+                break;
+        }
+
+        if (chunk_file_size(&file) <= MUTATOR_MAX_SIZE && !chunk_file_write(&file, &out, &out_size))
+        {
+            fp = fopen(argv[1], "wb");
+            if (fp)
+            {
+                result = fwrite(out, 1, out_size, fp) != out_size;
+                result |= fclose(fp) != 0;
+            }
+            free(out);
+        }
+    }
+    else
+    {
+        result = 0;
+    }
+
+    chunk_file_free(&file);
+
+cleanup:
+    free(data);
+    return result;
+}
@@ -0,0 +1,564 @@
+/*
+ * Content-addressed corpus store.
+ *
+ * Usage: corpus_store [-f] <store_dir> [source_dir|file]...
+ *
+ * Every file in the sources (and every badly named file in the store) is
+ * hashed in parallel and copied into the store as <sha256[:40]>.png, so
+ * identical content always ends up under the same name and only once.
+ * Sources are incremental: files older than the index were ingested by a
+ * previous run and are skipped, unless -f is given.
+ *
+ * <store_dir>.index then describes every entry, one line each:
+ *   <sha> <size> <width> <height> <bit_depth> <color_type> <interlace> <chunks>
+ * where <chunks> lists chunk types in file order, runs as IDAT*12.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pool.h"
+
+#define KEY_LENGTH 40
+#define CHUNKS_LENGTH 256
+
+struct entry
+{
+    char *path;
+    char key[KEY_LENGTH + 1];
+    int in_store;
+    int ok;
+
+    size_t size;
+    uint32_t width, height;
+    unsigned bit_depth, color_type, interlace;
+    char chunks[CHUNKS_LENGTH];
+};
+
+struct entries
+{
+    struct entry *items;
+    size_t count;
+    size_t capacity;
+};
+
+// SHA-256 (FIPS 180-4)
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const uint8_t *block)
+{
+    uint32_t w[64], s[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, state, sizeof(s));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = s[7] + (ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(&s[1], &s[0], 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; i++)
+        state[i] += s[i];
+}
+
+static void sha256_key(const uint8_t *data, size_t size, char key[KEY_LENGTH + 1])
+{
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t tail[128] = {0};
+    size_t full = size & ~(size_t)63, rest = size - full;
+
+    for (size_t i = 0; i < full; i += 64)
+        sha256_block(state, data + i);
+
+    // Padding: 0x80, zeros, then the length in bits (one or two blocks)
+    if (rest)
+        memcpy(tail, data + full, rest);
+    tail[rest] = 0x80;
+    size_t blocks = rest < 56 ? 1 : 2;
+    uint64_t bits = (uint64_t)size * 8;
+    for (int i = 0; i < 8; i++)
+        tail[blocks * 64 - 1 - i] = bits >> (i * 8);
+
+    for (size_t i = 0; i < blocks; i++)
+        sha256_block(state, tail + i * 64);
+
+    for (int i = 0; i < KEY_LENGTH / 2; i++)
+        sprintf(&key[i * 2], "%02x", (state[i / 4] >> (24 - (i % 4) * 8)) & 0xff);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Walks the chunk list without decoding anything, fuzzed files are often truncated
+static void describe(struct entry *entry, const uint8_t *data, size_t size)
+{
+    static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    char last[5] = "";
+    unsigned run = 0;
+    size_t length = 0, offset = 8;
+
+    entry->width = entry->height = 0;
+    entry->bit_depth = entry->color_type = entry->interlace = 0;
+    strcpy(entry->chunks, "-");
+
+    if (size < 8 || memcmp(data, signature, 8))
+        return;
+
+    entry->chunks[0] = '\0';
+    for (;;)
+    {
+        char type[5] = "";
+        int end = size - offset < 8;
+
+        if (!end)
+        {
+            uint32_t chunk = be32(data + offset);
+            memcpy(type, data + offset + 4, 4);
+            for (int i = 0; i < 4; i++)
+                if (!isalpha((unsigned char)type[i]))
+                    type[i] = '?';
+
+            if (!strcmp(type, "IHDR") && size - offset >= 8 + 13)
+            {
+                entry->width = be32(data + offset + 8);
+                entry->height = be32(data + offset + 12);
+                entry->bit_depth = data[offset + 16];
+                entry->color_type = data[offset + 17];
+                entry->interlace = data[offset + 20];
+            }
+
+            offset += (size_t)chunk + 12 > size - offset ? size - offset : (size_t)chunk + 12;
+        }
+
+        // Flush the previous run when the type changes or the file ends
+        if (run && (end || strcmp(type, last)))
+        {
+            char item[16];
+            snprintf(item, sizeof(item), run > 1 ? "%s%s*%u" : "%s%s", length ? "," : "", last, run);
+            if (length + strlen(item) + 4 >= CHUNKS_LENGTH)
+            {
+                strcpy(entry->chunks + length, ",..");
+                return;
+            }
+            strcpy(entry->chunks + length, item);
+            length += strlen(item);
+            run = 0;
+        }
+
+        if (end)
+            return;
+
+        strcpy(last, type);
+        run++;
+    }
+}
+
+static int entry_load(struct entry *entry, int hash)
+{
+    struct stat st;
+    const uint8_t *data = NULL;
+
+    int fd = open(entry->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st))
+    {
+        printf("FAIL on %s: %s\n", __func__, entry->path);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    entry->size = st.st_size;
+    if (entry->size)
+    {
+        data = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            printf("FAIL on %s: mmap(%s)\n", __func__, entry->path);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    if (hash)
+        sha256_key(data, entry->size, entry->key);
+    describe(entry, data, entry->size);
+
+    if (data)
+        munmap((void *)data, entry->size);
+    return 0;
+}
+
+static void hash_entries(void *arg, size_t begin, size_t end)
+{
+    struct entry *entries = arg;
+
+    for (size_t i = begin; i < end; i++)
+        entries[i].ok = !entry_load(&entries[i], 1);
+}
+
+// Entries the index already knew have no path
+static void describe_entries(void *arg, size_t begin, size_t end)
+{
+    struct entry *entries = arg;
+
+    for (size_t i = begin; i < end; i++)
+        if (entries[i].path)
+            entries[i].ok = !entry_load(&entries[i], 0);
+}
+
+static struct entry *entries_add(struct entries *entries)
+{
+    if (entries->count == entries->capacity)
+    {
+        size_t capacity = entries->capacity ? entries->capacity * 2 : 1024;
+        struct entry *items = realloc(entries->items, capacity * sizeof(struct entry));
+        if (!items)
+            return NULL;
+
+        entries->items = items;
+        entries->capacity = capacity;
+    }
+
+    struct entry *entry = &entries->items[entries->count++];
+    memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+static void entries_free(struct entries *entries)
+{
+    for (size_t i = 0; i < entries->count; i++)
+        free(entries->items[i].path);
+    free(entries->items);
+}
+
+static int key_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct entry *)a)->key, ((const struct entry *)b)->key);
+}
+
+// <40 hex>.png, the name the store gives to a file
+static int canonical_name(const char *name, char key[KEY_LENGTH + 1])
+{
+    for (int i = 0; i < KEY_LENGTH; i++)
+        if (!isxdigit((unsigned char)name[i]) || isupper((unsigned char)name[i]))
+            return 0;
+
+    if (strcmp(name + KEY_LENGTH, ".png"))
+        return 0;
+
+    memcpy(key, name, KEY_LENGTH);
+    key[KEY_LENGTH] = '\0';
+    return 1;
+}
+
+static int collect(struct entries *entries, const char *source, int in_store, int force, time_t since)
+{
+    struct stat st;
+    char path[4096];
+
+    if (stat(source, &st))
+    {
+        printf("FAIL on %s: stat(%s)\n", __func__, source);
+        return 1;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        struct entry *entry = entries_add(entries);
+        if (!entry || !(entry->path = strdup(source)))
+            return 1;
+        return 0;
+    }
+
+    DIR *dir = opendir(source);
+    if (!dir)
+        return 1;
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)))
+    {
+        char key[KEY_LENGTH + 1];
+
+        if (dirent->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", source, dirent->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        // Trust names the store gave, and what a previous run already ingested
+        if (!force && in_store && canonical_name(dirent->d_name, key))
+            continue;
+        if (!force && !in_store && st.st_mtime < since)
+            continue;
+
+        struct entry *entry = entries_add(entries);
+        if (!entry || !(entry->path = strdup(path)))
+        {
+            closedir(dir);
+            return 1;
+        }
+        entry->in_store = in_store;
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+static int copy_file(const char *from, const char *to)
+{
+    char tmp[4096 + 8], buffer[1 << 16];
+    ssize_t n = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", to);
+
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return 1;
+
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return 1;
+    }
+
+    while ((n = read(in, buffer, sizeof(buffer))) > 0)
+        if (write(out, buffer, n) != n)
+        {
+            n = -1;
+            break;
+        }
+
+    close(in);
+    if (close(out) || n < 0 || rename(tmp, to))
+    {
+        unlink(tmp);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int index_load(const char *filename, struct entries *index)
+{
+    char line[CHUNKS_LENGTH + 128];
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '#')
+            continue;
+
+        struct entry *entry = entries_add(index);
+        if (!entry)
+            break;
+
+        if (sscanf(line, "%40s %zu %u %u %u %u %u %255s", entry->key, &entry->size, &entry->width, &entry->height,
+                   &entry->bit_depth, &entry->color_type, &entry->interlace, entry->chunks) != 8)
+            index->count--;
+    }
+
+    fclose(fp);
+    qsort(index->items, index->count, sizeof(struct entry), key_compare);
+    return 0;
+}
+
+static int index_write(const char *filename, struct entries *index)
+{
+    char tmp[4096 + 8];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp)
+        return 1;
+
+    fprintf(fp, "# sha256[:40] size width height bit_depth color_type interlace chunks\n");
+    for (size_t i = 0; i < index->count; i++)
+    {
+        struct entry *entry = &index->items[i];
+
+        // Unreadable this time, retried on the next run
+        if (!entry->ok)
+            continue;
+
+        fprintf(fp, "%s %zu %u %u %u %u %u %s\n", entry->key, entry->size, entry->width, entry->height,
+                entry->bit_depth, entry->color_type, entry->interlace, entry->chunks);
+    }
+
+    if (fclose(fp) || rename(tmp, filename))
+    {
+        unlink(tmp);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct entries sources = {0}, old_index = {0}, index = {0};
+    char index_path[4096], target[4096];
+    struct stat st;
+    int force = 0, result = 1;
+    size_t added = 0, renamed = 0, duplicates = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-f"))
+    {
+        force = 1;
+        argv++;
+        argc--;
+    }
+
+    if (argc < 2)
+    {
+        printf("Usage: %s [-f] <store_dir> [source_dir|file]...\n", argv[0]);
+        return 1;
+    }
+
+    char *store = argv[1];
+    size_t length = strlen(store);
+    while (length > 1 && store[length - 1] == '/')
+        store[--length] = '\0';
+
+    snprintf(index_path, sizeof(index_path), "%s.index", store);
+    time_t since = stat(index_path, &st) ? 0 : st.st_mtime;
+    time_t started = time(NULL);
+
+    mkdir(store, 0755);
+    if (collect(&sources, store, 1, force, since))
+        goto cleanup;
+    for (int i = 2; i < argc; i++)
+        if (collect(&sources, argv[i], 0, force, since))
+            goto cleanup;
+
+    unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct pool *pool = pool_create(threads);
+    if (!pool)
+        goto cleanup;
+
+    pool_run(pool, hash_entries, sources.items, sources.count, 16);
+
+    // Sequential from here, the first copy of some content wins
+    for (size_t i = 0; i < sources.count; i++)
+    {
+        struct entry *entry = &sources.items[i];
+        if (!entry->ok)
+            continue;
+
+        snprintf(target, sizeof(target), "%s/%s.png", store, entry->key);
+        if (!strcmp(entry->path, target))
+            continue;
+
+        if (!access(target, F_OK))
+        {
+            if (entry->in_store)
+                unlink(entry->path);
+            duplicates++;
+        }
+        else if (entry->in_store)
+        {
+            renamed += !rename(entry->path, target);
+        }
+        else
+        {
+            added += !copy_file(entry->path, target);
+        }
+    }
+
+    // Only entries the index does not know yet have to be read
+    index_load(index_path, &old_index);
+
+    DIR *dir = opendir(store);
+    struct dirent *dirent;
+    while (dir && (dirent = readdir(dir)))
+    {
+        struct entry key, *entry, *known;
+
+        if (!canonical_name(dirent->d_name, key.key))
+            continue;
+
+        if (!(entry = entries_add(&index)))
+            break;
+
+        known = force || !old_index.count ? NULL : bsearch(&key, old_index.items, old_index.count, sizeof(struct entry), key_compare);
+        if (known)
+        {
+            *entry = *known;
+            entry->path = NULL;
+            entry->ok = 1;
+        }
+        else
+        {
+            snprintf(target, sizeof(target), "%s/%s", store, dirent->d_name);
+            entry->path = strdup(target);
+            memcpy(entry->key, key.key, sizeof(key.key));
+        }
+    }
+    if (dir)
+        closedir(dir);
+
+    pool_run(pool, describe_entries, index.items, index.count, 16);
+    pool_destroy(pool);
+
+    qsort(index.items, index.count, sizeof(struct entry), key_compare);
+    if (index_write(index_path, &index))
+    {
+        printf("FAIL on %s: writing %s\n", __func__, index_path);
+        goto cleanup;
+    }
+
+    // Stamped with the start of the run, files that landed during it are picked up next time
+    struct timespec times[2] = {{started, 0}, {started, 0}};
+    utimensat(AT_FDCWD, index_path, times, 0);
+
+    size_t indexed = 0;
+    for (size_t i = 0; i < index.count; i++)
+        indexed += index.items[i].ok;
+
+    printf("%zu files hashed on %u threads: %zu added, %zu renamed, %zu duplicates, %zu entries in %s\n",
+           sources.count, threads, added, renamed, duplicates, indexed, index_path);
+    result = 0;
+
+cleanup:
+    entries_free(&sources);
+    entries_free(&old_index);
+    entries_free(&index);
+    return result;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Usage: profile-merge.sh <merged.profdata> <profile_dir> [fanout]
+#
+# Folds every .profraw in <profile_dir> that is newer than <merged.profdata>
+# into it. Profiles are merged as a tree: each level merges groups of
+# <fanout> files on all cores, until a single profile is left.
+set -e
+
+out=$1
+dir=$2
+fanout=${3:-16}
+
+if [ -z "$out" ] || [ -z "$dir" ]; then
+    echo "Usage: $0 <merged.profdata> <profile_dir> [fanout]"
+    exit 1
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Anything written while we merge is picked up by the next run
+touch "$work/stamp"
+if [ -f "$out" ]; then
+    find "$dir" -name "*.profraw" -newer "$out" > "$work/level"
+else
+    find "$dir" -name "*.profraw" > "$work/level"
+fi
+
+count=$(wc -l < "$work/level")
+if [ "$count" -eq 0 ]; then
+    echo "-> No new profiles since $out"
+    exit 0
+fi
+echo "-> Merging $count new profiles"
+
+[ -f "$out" ] && echo "$out" >> "$work/level"
+
+depth=0
+while :; do
+    depth=$((depth + 1))
+    split -l "$fanout" -d -a 6 "$work/level" "$work/group$depth."
+
+    ls "$work"/group$depth.* > "$work/groups"
+    xargs -P "$(nproc)" -I{} llvm-profdata merge -sparse -f {} -o {}.profdata < "$work/groups"
+    ls "$work"/group$depth.*.profdata > "$work/level"
+
+    [ "$(wc -l < "$work/level")" -gt 1 ] || break
+done
+
+mv "$(cat "$work/level")" "$out"
+touch -r "$work/stamp" "$out"
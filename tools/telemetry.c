@@ -0,0 +1,170 @@
+/*
+ * Live view of the harness's per-stage telemetry.
+ *
+ * Usage: telemetry [-r] <segment> [interval]
+ *
+ * Maps the shared memory segment the harness processes write to when run
+ * with HARNESS_TELEMETRY=<segment>, and prints p50, p99 and max of the time,
+ * bytes and allocations of every stage, every [interval] seconds (1 by
+ * default, 0 prints once). Percentiles are the upper bound of their log2
+ * bucket, so they are within a factor of two. -r zeroes the segment first,
+ * counts from running workers keep coming in.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "telemetry.h"
+
+_Static_assert(TELEMETRY_STAGES == 7, "stage names out of date");
+
+static const char *stage_names[TELEMETRY_STAGES] = {
+    [TELEMETRY_PNGTOPNG] = "pngtopng",
+    [TELEMETRY_EXAMPLE1] = "example1",
+    [TELEMETRY_READ] = "read",
+    [TELEMETRY_PROCESS] = "process",
+    [TELEMETRY_WRITE] = "write",
+    [TELEMETRY_STREAM] = "stream",
+    [TELEMETRY_PROGRESSIVE] = "progressive",
+};
+
+// Upper bound of the bucket holding the quantile, capped by the maximum
+static unsigned long long quantile(const struct telemetry_histogram *histogram, double q)
+{
+    unsigned long long rank = histogram->count * q, seen = 0;
+
+    for (int bucket = 0; bucket < TELEMETRY_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen > rank)
+        {
+            unsigned long long bound = bucket ? (bucket < 64 ? (1ull << bucket) - 1 : ~0ull) : 0;
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+static void print_time(unsigned long long ticks, double ticks_per_ns)
+{
+    double us = ticks / ticks_per_ns / 1e3;
+    if (us < 1e3)
+        printf(" %9.1fus", us);
+    else
+        printf(" %9.1fms", us / 1e3);
+}
+
+static void print_size(unsigned long long bytes)
+{
+    if (bytes < 1 << 20)
+        printf(" %9.1fK", bytes / 1024.0);
+    else
+        printf(" %9.1fM", bytes / 1048576.0);
+}
+
+static void print(const struct telemetry_segment *segment)
+{
+    // A consistent enough copy, the workers keep adding to the segment
+    static struct telemetry_segment snapshot;
+    memcpy(&snapshot, segment, sizeof(snapshot));
+
+    printf("%llu inputs\n", snapshot.inputs);
+    printf("stage            count     time p50     time p99     time max   bytes p50   bytes p99   bytes max"
+           "  allocs p50  allocs p99  allocs max\n");
+
+    for (int stage = 0; stage < TELEMETRY_STAGES; stage++)
+    {
+        const struct telemetry_histogram *ticks = &snapshot.stages[stage][TELEMETRY_TICKS];
+        const struct telemetry_histogram *bytes = &snapshot.stages[stage][TELEMETRY_BYTES];
+        const struct telemetry_histogram *allocations = &snapshot.stages[stage][TELEMETRY_ALLOCATIONS];
+
+        if (!ticks->count)
+            continue;
+
+        printf("%-12s %9llu ", stage_names[stage], ticks->count);
+        print_time(quantile(ticks, 0.5), snapshot.ticks_per_ns);
+        print_time(quantile(ticks, 0.99), snapshot.ticks_per_ns);
+        print_time(ticks->max, snapshot.ticks_per_ns);
+        print_size(quantile(bytes, 0.5));
+        print_size(quantile(bytes, 0.99));
+        print_size(bytes->max);
+        printf(" %11llu %11llu %11llu\n", quantile(allocations, 0.5), quantile(allocations, 0.99), allocations->max);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    int reset = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-r"))
+    {
+        reset = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2)
+    {
+        printf("Usage: telemetry [-r] <segment> [interval]\n");
+        return 1;
+    }
+
+    const char *name = argv[1];
+    unsigned interval = argc > 2 ? atoi(argv[2]) : 1;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        printf("FAIL on %s: shm_open(%s), is a harness running with HARNESS_TELEMETRY=%s?\n", __func__, name, name);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size != sizeof(struct telemetry_segment))
+    {
+        printf("FAIL on %s: %s has another layout\n", __func__, name);
+        close(fd);
+        return 1;
+    }
+
+    struct telemetry_segment *segment =
+        mmap(NULL, sizeof(struct telemetry_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        printf("FAIL on %s: mmap()\n", __func__);
+        return 1;
+    }
+
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC ||
+        segment->version != TELEMETRY_VERSION)
+    {
+        printf("FAIL on %s: %s is not telemetry version %d\n", __func__, name, TELEMETRY_VERSION);
+        return 1;
+    }
+
+    if (reset)
+    {
+        __atomic_store_n(&segment->inputs, 0, __ATOMIC_RELAXED);
+        memset(segment->stages, 0, sizeof(segment->stages));
+    }
+
+    for (;;)
+    {
+        print(segment);
+        if (!interval)
+            break;
+        sleep(interval);
+    }
+
+    munmap(segment, sizeof(struct telemetry_segment));
+    return 0;
+}